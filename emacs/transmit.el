@@ -69,10 +69,44 @@
   :group 'tools
   :prefix "transmit-")
 
-(defcustom transmit-keepalive-timeout (* 5 60)
-  "Seconds of inactivity before closing the SFTP connection."
+(defcustom transmit-keepalive-timeout (* 60 60)
+  "Seconds of inactivity before the helper drops its SSH session.
+The helper process stays running and reconnects on the next command or
+when Emacs regains focus.  0 keeps the session open indefinitely."
   :type 'integer :group 'transmit)
 
+(defcustom transmit-ssh-keepalive-interval 30
+  "Seconds between SSH keepalives the helper sends while idle."
+  :type 'integer :group 'transmit)
+
+(defcustom transmit-reconnect-on-focus t
+  "When non-nil, ask the helper to revive a stale session on focus-in."
+  :type 'boolean :group 'transmit)
+
+(defcustom transmit-prewarm t
+  "When non-nil, connect and cache remote directories ahead of the first save.
+A hint is sent when a project with a selected server is opened and again
+when a buffer under it is shown."
+  :type 'boolean :group 'transmit)
+
+(defcustom transmit-journal t
+  "When non-nil, the helper journals operations next to `transmit-data-file'.
+Uploads and removes it accepted but never finished, e.g. because Emacs or the
+helper crashed mid-sync, are replayed by the next helper for that account."
+  :type 'boolean :group 'transmit)
+
+(defcustom transmit-save-latency 2
+  "Seconds a save may wait behind a sync before the helper opens a connection.
+The helper gives the save a connection of its own once it has waited this
+long with every connection busy.  0 means no bound."
+  :type 'integer :group 'transmit)
+
+(defcustom transmit-hook-quiet-period 2
+  "Seconds without transfers under a remote before its server hook runs.
+Hooks are listed per remote name under \"hooks\" in the server config; a
+server's \"hook_quiet_period\" overrides this."
+  :type 'number :group 'transmit)
+
 (defcustom transmit-auth-timeout 30
   "Seconds to wait for SFTP authentication before giving up."
   :type 'integer :group 'transmit)
@@ -99,50 +133,119 @@ When nil the binary is found automatically."
   :type 'integer :group 'transmit)
 
 (defcustom transmit-stuck-timeout 60
-  "Seconds after which a processing queue item is considered stuck."
+  "Seconds after which a processing queue item is considered stuck.
+Only applies to older helpers; current ones fail a hung operation
+themselves and retry it on a fresh session."
   :type 'integer :group 'transmit)
 
 (defcustom transmit-reconnect-delay 1.5
   "Seconds to wait before reconnecting after a connection loss."
   :type 'number :group 'transmit)
 
+(defcustom transmit-watchdog-interval 5
+  "Seconds between checks for stuck queue items while work is pending.
+Display updates are pushed on change and do not depend on this timer."
+  :type 'number :group 'transmit)
+
+(defvar transmit-status-functions nil
+  "Abnormal hook run with the new status plist whenever it changes.
+The plist has :server, :remote, :connected, :connecting, :file, :percent,
+:queued, :in-flight, :last-hook and a preformatted :text summary.  While helper output
+streams in it runs at most once per `transmit--redisplay-interval'.")
+
 ;;;; ---- Internal State -------------------------------------------------------
 
 (defvar transmit--server-config (make-hash-table :test 'equal))
-(defvar transmit--queue '())
+(defvar transmit--queue '()
+  "Pending and in-flight operations, oldest first.
+Cancelled items stay in place with :cancelled set until they reach the head.")
+(defvar transmit--queue-tail nil "Last cons of `transmit--queue', for O(1) append.")
+(defvar transmit--queue-sent nil "Cons of the newest in-flight item, or nil.")
+(defvar transmit--queue-release nil
+  "Cons of the newest release step while it is in `transmit--queue'.
+Saves queued after it are linked behind it, never ahead.")
+(defvar transmit--queue-count 0 "Live (not cancelled) items in `transmit--queue'.")
+(defvar transmit--queue-by-id (make-hash-table :test 'eql))
+(defvar transmit--queue-by-file (make-hash-table :test 'equal)
+  "Unsent item per local file, so repeated saves collapse into one entry.")
 (defvar transmit--next-queue-id 1)
 (defvar transmit--process nil)
-(defvar transmit--process-buf "")
+(defvar transmit--process-buffer-name " *transmit-process*"
+  "Buffer receiving raw helper output until complete lines are parsed.")
+(defvar transmit--progress-prefix nil
+  "Regexp matching PROGRESS lines for the file currently in progress.")
+(defvar transmit--redisplay-timer nil)
 (defvar transmit--phase transmit--phase-init)
 (defvar transmit--connecting nil)
 (defvar transmit--connection-ready nil)
 (defvar transmit--is-exiting nil)
 (defvar transmit--pending-callback nil)
-(defvar transmit--keepalive-timer nil)
+(defvar transmit--helper-protocol 0)
+(defvar transmit--prewarmed (make-hash-table :test 'equal))
+(defvar transmit--defined (make-hash-table :test 'equal)
+  "Servers the running helper knows as copy endpoints.")
+(defvar transmit--hook-runs (make-hash-table :test 'equal)
+  "Last hook run per remote root, as a plist with :root, :status,
+:duration-ms, :output and :finished-at.")
+(defvar transmit--last-hook nil "Most recent entry of `transmit--hook-runs'.")
+(defvar transmit--prewarm-pending nil)
+(defvar transmit--credits 0
+  "Commands the helper is currently willing to accept.")
+(defvar transmit--credit-based nil
+  "Non-nil once the helper has granted credits; older helpers never do.")
+(defvar transmit--replay-settled t
+  "Non-nil once the helper has reported its journal replay.
+Until then nothing is sent, so resends it already finished can be dropped.")
+(defvar transmit--replayed (make-hash-table :test 'equal)
+  "\"op|remote-path\" of operations the journal replay finished or skipped.")
+(defvar transmit--queue-save-timer nil
+  "Pending write of `transmit--queue-file', or nil.")
+(defvar transmit--queue-resumed nil
+  "Non-nil once the queue a previous session left has been loaded.")
 (defvar transmit--auth-timeout-timer nil)
 (defvar transmit--current-progress (list :file nil :percent nil))
+(defvar transmit--status nil
+  "Last status plist published to `transmit-status-functions'.")
+(defvar transmit--modeline-string nil
+  "Rendered modeline segment for `transmit--status', or nil if stale.")
 (defvar transmit--watchers (make-hash-table :test 'equal))
 (defvar transmit--auto-upload-hook-installed nil)
-(defvar transmit--modeline-timer nil)
+(defvar transmit--watchdog-timer nil)
 (defvar transmit--active-server nil)
 (defvar transmit--active-remote nil)
 (defvar transmit--recent-uploads (make-hash-table :test 'equal))
+(defvar transmit--data-cache nil
+  "Parsed transmit.json, reused while its mtime and size are unchanged.")
+(defvar transmit--data-signature nil
+  "(MTIME . SIZE) of transmit.json when `transmit--data-cache' was read.")
+(defvar transmit--data-checked-at 0
+  "`float-time' of the last stat of transmit.json.")
+(defvar transmit--project-roots (make-hash-table :test 'equal)
+  "Directory → project root, so dispatch does not ask VC or project.el again.")
+(defvar transmit--remote-bases (make-hash-table :test 'equal)
+  "Project root → remote base path, rebuilt when the selection changes.")
 
 ;;;; ---- Project Root ---------------------------------------------------------
 
 (defun transmit--project-root (&optional dir)
-  "Return the project root for DIR (or `default-directory')."
+  "Return the project root for DIR (or `default-directory').
+Results are memoised per directory."
   (let ((d (expand-file-name (or dir default-directory))))
-    (or
-     (and (fboundp 'projectile-project-root)
-          (let ((root (ignore-errors (projectile-project-root d))))
-            (and root (not (string= root "")) (expand-file-name root))))
-     (and (fboundp 'project-current)
-          (let ((proj (ignore-errors (project-current nil d))))
-            (and proj (expand-file-name (project-root proj)))))
-     (let ((git (locate-dominating-file d ".git")))
-       (and git (expand-file-name git)))
-     d)))
+    (or (gethash d transmit--project-roots)
+        (puthash d (transmit--find-project-root d) transmit--project-roots))))
+
+(defun transmit--find-project-root (d)
+  "Locate the project root for expanded directory D."
+  (or
+   (and (fboundp 'projectile-project-root)
+        (let ((root (ignore-errors (projectile-project-root d))))
+          (and root (not (string= root "")) (expand-file-name root))))
+   (and (fboundp 'project-current)
+        (let ((proj (ignore-errors (project-current nil d))))
+          (and proj (expand-file-name (project-root proj)))))
+   (let ((git (locate-dominating-file d ".git")))
+     (and git (expand-file-name git)))
+   d))
 
 ;;;; ---- Logging --------------------------------------------------------------
 
@@ -163,20 +266,47 @@ When nil the binary is found automatically."
 
 ;;;; ---- State-file I/O -------------------------------------------------------
 
+(defconst transmit--data-revalidate-interval 1.0
+  "Seconds during which a cached transmit.json is trusted without a stat.")
+
 (defun transmit--read-data ()
-  "Return transmit.json as a hash-table, or nil on error."
-  (condition-case err
-      (if (file-exists-p transmit-data-file)
-          (let ((json-object-type 'hash-table)
-                (json-array-type 'list)
-                (json-key-type 'string))
-            (json-read-file transmit-data-file))
-        (let ((tbl (make-hash-table :test 'equal)))
-          (transmit--write-data tbl)
-          tbl))
-    (error
-     (transmit--log 4 (format "Failed to read transmit.json: %s" err) t)
-     nil)))
+  "Return transmit.json as a hash-table, or nil on error.
+The parsed table is cached and re-read only when the file's mtime or size
+changes; the file is stat'ed at most once per
+`transmit--data-revalidate-interval'."
+  (if (and transmit--data-cache
+           (< (- (float-time) transmit--data-checked-at)
+              transmit--data-revalidate-interval))
+      transmit--data-cache
+    (setq transmit--data-checked-at (float-time))
+    (condition-case err
+        (let* ((attrs (file-attributes transmit-data-file))
+               (signature (and attrs
+                               (cons (file-attribute-modification-time attrs)
+                                     (file-attribute-size attrs)))))
+          (cond
+           ((null attrs)
+            (let ((tbl (make-hash-table :test 'equal)))
+              (transmit--write-data tbl)
+              tbl))
+           ((and transmit--data-cache (equal signature transmit--data-signature))
+            transmit--data-cache)
+           (t
+            (let ((json-object-type 'hash-table)
+                  (json-array-type 'list)
+                  (json-key-type 'string))
+              (clrhash transmit--remote-bases)
+              (setq transmit--data-signature signature
+                    transmit--data-cache (json-read-file transmit-data-file))))))
+      (error
+       (transmit--log 4 (format "Failed to read transmit.json: %s" err) t)
+       nil))))
+
+(defun transmit--invalidate-data ()
+  "Forget the cached transmit.json and derived remote bases."
+  (setq transmit--data-cache nil
+        transmit--data-signature nil)
+  (clrhash transmit--remote-bases))
 
 (defun transmit--write-data (data)
   "Persist DATA to transmit.json. Returns non-nil on success."
@@ -184,6 +314,8 @@ When nil the binary is found automatically."
       (progn
         (make-directory (file-name-directory transmit-data-file) t)
         (with-temp-file transmit-data-file (insert (json-encode data)))
+        ;; DATA may have been edited in place; re-read it on next use.
+        (transmit--invalidate-data)
         t)
     (error
      (transmit--log 4 (format "Failed to write transmit.json: %s" err) t)
@@ -303,80 +435,328 @@ When nil the binary is found automatically."
 
 ;;;; ---- Queue ----------------------------------------------------------------
 
-(defun transmit--enqueue (type filename working-dir)
-  "Queue a TYPE operation for FILENAME in WORKING-DIR. Returns ID or nil."
+(defun transmit--enqueue (type filename working-dir &optional bulk)
+  "Queue a TYPE operation for FILENAME in WORKING-DIR. Returns ID or nil.
+BULK marks part of a sync or watcher burst; other items are saves and go
+ahead of unsent bulk items."
   (cl-block transmit--enqueue
     (unless (member type '("upload" "remove"))
       (transmit--log 4 (format "Invalid operation type: %s" type) t)
       (cl-return-from transmit--enqueue nil))
-    (let ((file (expand-file-name filename)))
-      (let ((existing (cl-find-if (lambda (i)
-                                    (string= (plist-get i :filename) file))
-                                  transmit--queue)))
-        (when existing
-          (cond
-           ((string= (plist-get existing :type) "upload")
-            (transmit--log 1 (format "Skipping duplicate queue entry for %s" file))
-            (cl-return-from transmit--enqueue nil))
-           ((and (string= (plist-get existing :type) "remove")
-                 (string= type "upload"))
-            (transmit--log 1 (format "Upgrading remove→upload for %s" file))
-            (plist-put existing :type "upload")
-            (cl-return-from transmit--enqueue (plist-get existing :id)))
-           ((string= type "remove")
-            (cl-return-from transmit--enqueue nil)))))
-      (let ((id transmit--next-queue-id))
+    (let* ((file (expand-file-name filename))
+           ;; Only unsent items can absorb a new request; an item already with
+           ;; the helper may have read the file before this change, and one
+           ;; queued before a release step would send it ahead of the step.
+           (existing (gethash file transmit--queue-by-file)))
+      (when (and existing
+                 (not (and transmit--queue-release
+                           (< (plist-get existing :id)
+                              (plist-get (car transmit--queue-release) :id)))))
+        (unless (string= (plist-get existing :type) type)
+          (transmit--log 1 (format "Replacing queued %s with %s for %s"
+                                   (plist-get existing :type) type file))
+          (plist-put existing :type type)
+          (transmit--queue-changed))
+        ;; A save landing on an item of a sync is still a save
+        (when (and (plist-get existing :bulk) (not bulk))
+          (transmit--log 1 (format "Promoting queued %s to a save for %s"
+                                   (plist-get existing :type) file))
+          (transmit--promote-to-save existing)
+          (transmit--queue-changed))
+        (cl-return-from transmit--enqueue (plist-get existing :id)))
+      (let* ((id transmit--next-queue-id)
+             (item (list :id id
+                         :type type
+                         :filename file
+                         :working-dir working-dir
+                         :processing nil
+                         :started-at nil
+                         :bulk bulk))
+             (cell (list item)))
         (cl-incf transmit--next-queue-id)
-        (setq transmit--queue
-              (nconc transmit--queue
-                     (list (list :id id
-                                 :type type
-                                 :filename file
-                                 :working-dir working-dir
-                                 :processing nil
-                                 :started-at nil))))
+        (cond
+         (bulk
+          (if transmit--queue-tail
+              (setcdr transmit--queue-tail cell)
+            (setq transmit--queue cell))
+          (setq transmit--queue-tail cell))
+         (t (transmit--link-before-bulk cell)))
+        (cl-incf transmit--queue-count)
+        (puthash id item transmit--queue-by-id)
+        (puthash file item transmit--queue-by-file)
         (transmit--log 1 (format "Queued [%d]: %s %s" id type file))
+        (transmit--queue-changed)
         (transmit--modeline-refresh)
-        (transmit--start-modeline-timer)
+        (transmit--start-watchdog)
         (transmit--ensure-connection #'transmit--process-next)
         id))))
 
+(defun transmit--enqueue-at-tail (props description)
+  "Queue a bulk item with PROPS behind everything else. Returns its ID.
+DESCRIPTION is logged.  Such items aren't indexed by file, so nothing
+absorbs them."
+  (let* ((id transmit--next-queue-id)
+         (item (append (list :id id) props
+                       (list :processing nil :started-at nil :bulk t)))
+         (cell (list item)))
+    (cl-incf transmit--next-queue-id)
+    (if transmit--queue-tail
+        (setcdr transmit--queue-tail cell)
+      (setq transmit--queue cell))
+    (setq transmit--queue-tail cell)
+    (cl-incf transmit--queue-count)
+    (puthash id item transmit--queue-by-id)
+    (transmit--log 1 (format "Queued [%d]: %s" id description))
+    (transmit--queue-changed)
+    (transmit--modeline-refresh)
+    (transmit--start-watchdog)
+    (transmit--ensure-connection #'transmit--process-next)
+    id))
+
+(defun transmit--enqueue-copy (source target)
+  "Queue a copy from SOURCE to TARGET, both \"server:path\". Returns ID."
+  (transmit--enqueue-at-tail
+   (list :type "copy" :filename source :target target
+         :working-dir default-directory)
+   (format "copy %s -> %s" source target)))
+
+(defun transmit--enqueue-release (action root)
+  "Queue release step ACTION for the project at ROOT. Returns ID.
+At the tail, so whatever was queued before the step is sent before it."
+  (prog1 (transmit--enqueue-at-tail
+          (list :type "release" :action action :filename root :working-dir root)
+          (format "release %s %s" action root))
+    (setq transmit--queue-release transmit--queue-tail)))
+
+(defun transmit--link-before-bulk (cell)
+  "Link CELL behind sent items and unsent saves, ahead of unsent bulk items.
+A save thus never waits for a large sync to drain.  An unsent release step
+is a barrier: CELL goes behind it."
+  (let* ((prev (if (and transmit--queue-release
+                        (not (plist-get (car transmit--queue-release) :processing)))
+                   transmit--queue-release
+                 transmit--queue-sent))
+         (next (if prev (cdr prev) transmit--queue)))
+    (while (and next (not (plist-get (car next) :bulk)))
+      (setq prev next
+            next (cdr next)))
+    (setcdr cell next)
+    (if prev
+        (setcdr prev cell)
+      (setq transmit--queue cell))
+    (unless next
+      (setq transmit--queue-tail cell))))
+
+(defun transmit--promote-to-save (item)
+  "Turn unsent bulk ITEM into a save and relink it where a new save would go."
+  (let* ((prev transmit--queue-sent)
+         (cell (if prev (cdr prev) transmit--queue)))
+    (while (and cell (not (eq (car cell) item)))
+      (setq prev cell
+            cell (cdr cell)))
+    (when cell
+      (if prev
+          (setcdr prev (cdr cell))
+        (setq transmit--queue (cdr cell)))
+      (when (eq cell transmit--queue-tail)
+        (setq transmit--queue-tail prev))
+      (setcdr cell nil)
+      (plist-put item :bulk nil)
+      (transmit--link-before-bulk cell))))
+
+(defun transmit--unindex-pending (item)
+  "Drop ITEM from the per-file index if it is the entry there."
+  (let ((file (plist-get item :filename)))
+    (when (eq (gethash file transmit--queue-by-file) item)
+      (remhash file transmit--queue-by-file))))
+
 (defun transmit--queue-head ()
-  "Return the first queue item, or nil."
+  "Return the first live queue item, or nil."
+  (while (and transmit--queue (plist-get (car transmit--queue) :cancelled))
+    (transmit--pop-queue))
   (car transmit--queue))
 
+(defun transmit--pop-queue ()
+  "Unlink the first cons of `transmit--queue'."
+  (when (eq transmit--queue transmit--queue-sent)
+    (setq transmit--queue-sent nil))
+  (when (eq transmit--queue transmit--queue-release)
+    (setq transmit--queue-release nil))
+  (setq transmit--queue (cdr transmit--queue))
+  (unless transmit--queue
+    (setq transmit--queue-tail nil)))
+
 (defun transmit--dequeue ()
   "Remove the first queue item."
-  (setq transmit--queue (cdr transmit--queue))
+  (let ((item (transmit--queue-head)))
+    (when item
+      (transmit--pop-queue)
+      (remhash (plist-get item :id) transmit--queue-by-id)
+      (transmit--unindex-pending item)
+      (cl-decf transmit--queue-count)))
+  (transmit--request-redisplay))
+
+(defun transmit--cancel-queue-item (id)
+  "Cancel unsent queue item ID in place. Returns non-nil on success."
+  (let ((item (gethash id transmit--queue-by-id)))
+    (when (and item (not (plist-get item :processing)))
+      (plist-put item :cancelled t)
+      (remhash id transmit--queue-by-id)
+      (transmit--unindex-pending item)
+      (cl-decf transmit--queue-count)
+      (transmit--queue-changed)
+      t)))
+
+(defun transmit--next-unsent ()
+  "Return the cons of the first item not yet sent, skipping cancelled ones."
+  (let ((cell (if transmit--queue-sent (cdr transmit--queue-sent) transmit--queue)))
+    (while (and cell (plist-get (car cell) :cancelled))
+      (setq cell (cdr cell)))
+    cell))
+
+(defun transmit--requeue-in-flight ()
+  "Mark every in-flight item unsent again, e.g. after losing the helper."
+  (when transmit--queue-sent
+    (let ((cell transmit--queue)
+          (done nil))
+      (while (and cell (not done))
+        (let ((item (car cell)))
+          (when (plist-get item :processing)
+            (plist-put item :processing nil)
+            (plist-put item :started-at nil)
+            (unless (gethash (plist-get item :filename) transmit--queue-by-file)
+              (puthash (plist-get item :filename) item transmit--queue-by-file))))
+        (setq done (eq cell transmit--queue-sent)
+              cell (cdr cell))))
+    (setq transmit--queue-sent nil)
+    (transmit--queue-changed)))
+
+(defun transmit--queue-items ()
+  "Return the live queue items as a fresh list."
+  (cl-loop for item in transmit--queue
+           unless (plist-get item :cancelled)
+           collect item))
+
+(defun transmit--queue-file ()
+  "Return the file holding the unsent queue between sessions."
+  (expand-file-name "transmit-queue.eld" (file-name-directory transmit-data-file)))
+
+(defun transmit--save-queue ()
+  "Write the unsent queue items to `transmit--queue-file'.
+Items with the helper are left out: it finishes them even when Emacs goes
+away, and its journal covers the ones it can't."
+  (setq transmit--queue-save-timer nil)
+  (let ((file (transmit--queue-file))
+        (entries (cl-loop for item in transmit--queue
+                          unless (or (plist-get item :cancelled)
+                                     (plist-get item :processing))
+                          collect (cl-loop for key in '(:type :filename :target :action
+                                                        :working-dir :bulk :remote-path)
+                                           when (plist-get item key)
+                                           append (list key (plist-get item key))))))
+    (condition-case err
+        (if (null entries)
+            (when (file-exists-p file)
+              (delete-file file))
+          (let ((tmp (concat file ".tmp")))
+            (with-temp-file tmp
+              (let ((print-length nil) (print-level nil))
+                (prin1 entries (current-buffer))))
+            (rename-file tmp file t)))
+      (error
+       (transmit--log 3 (format "Failed to save the queue: %s" err))))))
+
+(defun transmit--queue-changed ()
+  "Note a queue change; `transmit--queue-file' is rewritten within a second."
+  (unless transmit--queue-save-timer
+    (setq transmit--queue-save-timer
+          (run-with-timer 1 nil #'transmit--save-queue))))
+
+(defun transmit--resume-queue ()
+  "Queue again what a previous session left unsent, in its original order.
+Items a dead helper had accepted wait for the next helper's journal replay,
+like any other resend.  Returns how many were resumed."
+  (let* ((file (transmit--queue-file))
+         (entries (and (not transmit--queue-resumed)
+                       (file-readable-p file)
+                       (condition-case err
+                           (with-temp-buffer
+                             (insert-file-contents file)
+                             (read (current-buffer)))
+                         (error
+                          (transmit--log 3 (format "Ignoring unreadable queue file %s: %s" file err))
+                          nil))))
+         (count 0))
+    (setq transmit--queue-resumed t)
+    (dolist (entry (and (listp entries) entries))
+      (let* ((type (plist-get entry :type))
+             (filename (plist-get entry :filename))
+             (per-file (member type '("upload" "remove"))))
+        (when (and (member type '("upload" "remove" "copy" "release"))
+                   (stringp filename)
+                   (stringp (plist-get entry :working-dir))
+                   (not (and per-file (gethash filename transmit--queue-by-file))))
+          (let* ((id transmit--next-queue-id)
+                 (item (append (list :id id) entry (list :processing nil :started-at nil)))
+                 (cell (list item)))
+            (cl-incf transmit--next-queue-id)
+            ;; Saved in queue order, so appending keeps saves ahead of bulk
+            ;; items and behind their release steps
+            (if transmit--queue-tail
+                (setcdr transmit--queue-tail cell)
+              (setq transmit--queue cell))
+            (setq transmit--queue-tail cell)
+            (cl-incf transmit--queue-count)
+            (puthash id item transmit--queue-by-id)
+            (cond (per-file (puthash filename item transmit--queue-by-file))
+                  ((string= type "release") (setq transmit--queue-release cell)))
+            (cl-incf count)))))
+    (when (> count 0)
+      (transmit--log 2 (format "Resuming %d queued operation(s) from the last session" count) t)
+      (transmit--modeline-refresh)
+      (transmit--start-watchdog)
+      (transmit--ensure-connection #'transmit--process-next))
+    count))
+
+(defun transmit--settle-replayed ()
+  "Drop unsent items the helper's journal replay finished or skipped.
+Sending starts afterwards."
+  (dolist (item (transmit--queue-items))
+    (let ((remote-path (plist-get item :remote-path)))
+      (when (and remote-path
+                 (not (plist-get item :processing))
+                 (gethash (format "%s|%s" (plist-get item :type) remote-path)
+                          transmit--replayed))
+        (transmit--log 1 (format "Already replayed by the helper: %s"
+                                 (plist-get item :filename)))
+        (transmit--cancel-queue-item (plist-get item :id)))))
+  (clrhash transmit--replayed)
+  (setq transmit--replay-settled t)
   (transmit--modeline-refresh))
 
+(defun transmit--in-flight-count ()
+  "Return how many queue items are with the helper."
+  (if (not transmit--queue-sent)
+      0
+    (cl-loop for cell on transmit--queue
+             count (plist-get (car cell) :processing)
+             until (eq cell transmit--queue-sent))))
+
+(defun transmit--has-send-budget-p ()
+  "Return non-nil if the helper's credit window allows another command.
+Helpers without flow control get one command at a time.  Nothing goes out
+before the helper has reported its journal replay."
+  (and (or (< transmit--helper-protocol 10) transmit--replay-settled)
+       (if transmit--credit-based
+           (> transmit--credits 0)
+         (null transmit--queue-sent))))
+
 (defun transmit--find-queue-item (id)
-  "Return (item . index) for queue item ID, or nil."
-  (cl-loop for item in transmit--queue
-           for i from 0
-           when (= (plist-get item :id) id)
-           return (cons item i)))
+  "Return the live queue item with ID, or nil."
+  (gethash id transmit--queue-by-id))
 
 ;;;; ---- Timers ---------------------------------------------------------------
 
-(defun transmit--reset-keepalive ()
-  "Restart the idle-disconnect timer."
-  (when transmit--keepalive-timer (cancel-timer transmit--keepalive-timer))
-  (setq transmit--keepalive-timer
-        (run-with-timer transmit-keepalive-timeout nil
-                        (lambda ()
-                          (when transmit--process
-                            (condition-case nil
-                                (process-send-string transmit--process "exit\n")
-                              (error nil))
-                            (setq transmit--process nil
-                                  transmit--phase transmit--phase-init
-                                  transmit--connecting nil
-                                  transmit--connection-ready nil)
-                            (transmit--log 2 "SFTP closed after inactivity" t))
-                          (setq transmit--keepalive-timer nil)
-                          (transmit--modeline-refresh)))))
-
 (defun transmit--start-auth-timeout ()
   "Start the authentication watchdog timer."
   (when transmit--auth-timeout-timer (cancel-timer transmit--auth-timeout-timer))
@@ -400,15 +780,15 @@ When nil the binary is found automatically."
     (cancel-timer transmit--auth-timeout-timer)
     (setq transmit--auth-timeout-timer nil)))
 
-(defun transmit--start-modeline-timer ()
-  "Start a repeating timer to refresh the modeline during uploads."
-  (unless transmit--modeline-timer
-    (setq transmit--modeline-timer
-          (run-with-timer 0.5 0.5 #'transmit--watchdog))))
+(defun transmit--start-watchdog ()
+  "Start a repeating timer that unsticks the queue while work is pending."
+  (unless transmit--watchdog-timer
+    (setq transmit--watchdog-timer
+          (run-with-timer transmit-watchdog-interval transmit-watchdog-interval
+                          #'transmit--watchdog))))
 
 (defun transmit--watchdog ()
-  "Refresh modeline and unstick queue if process has died or stalled."
-  (force-mode-line-update t)
+  "Unstick queue if process has died or stalled."
   (let ((head (transmit--queue-head)))
     (when head
       (let* ((processing   (plist-get head :processing))
@@ -418,15 +798,16 @@ When nil the binary is found automatically."
                                      (process-live-p transmit--process))))
              (stuck (and processing
                          (or process-dead
-                             (and elapsed (> elapsed transmit-stuck-timeout))))))
+                             (and elapsed
+                                  (< transmit--helper-protocol 6)
+                                  (> elapsed transmit-stuck-timeout))))))
         (cond
          (stuck
           (transmit--log 2
                          (if process-dead
                              "Watchdog: unsticking (process died)"
                            (format "Watchdog: unsticking (stalled %.0fs)" elapsed)))
-          (plist-put head :processing nil)
-          (plist-put head :started-at nil)
+          (transmit--requeue-in-flight)
           (setq transmit--connection-ready nil
                 transmit--connecting nil)
           (when process-dead (setq transmit--process nil))
@@ -442,33 +823,64 @@ When nil the binary is found automatically."
                           (lambda ()
                             (transmit--ensure-connection #'transmit--process-next)))))))))
 
-(defun transmit--stop-modeline-timer ()
-  "Stop the modeline refresh timer."
-  (when transmit--modeline-timer
-    (cancel-timer transmit--modeline-timer)
-    (setq transmit--modeline-timer nil)))
+(defun transmit--stop-watchdog ()
+  "Stop the watchdog timer."
+  (when transmit--watchdog-timer
+    (cancel-timer transmit--watchdog-timer)
+    (setq transmit--watchdog-timer nil)))
 
 ;;;; ---- Modeline -------------------------------------------------------------
 
 (defvar transmit--modeline-segment-form '(:eval (transmit--modeline-segment))
   "Form evaluated by doom-modeline/mode-line to render the transmit segment.")
 
-(defun transmit--modeline-segment ()
-  "Compute and return the transmit modeline string live."
-  (let* ((progress (transmit-get-progress))
-         (file (plist-get progress :file))
-         (pct (or (plist-get progress :percent) 0))
-         (queue-len (length transmit--queue))
+(defun transmit--compute-status ()
+  "Return a fresh status plist summarising connection, progress and queue."
+  (let ((file (plist-get transmit--current-progress :file))
+        (pct (plist-get transmit--current-progress :percent))
+        (queued transmit--queue-count))
+    (list :server transmit--active-server
+          :remote transmit--active-remote
+          :connected (and transmit--connection-ready t)
+          :connecting (and transmit--connecting t)
+          :file file
+          :percent pct
+          :queued queued
+          :in-flight (transmit--in-flight-count)
+          :last-hook transmit--last-hook
+          :text (cond
+                 (file (format "%s %d%%%s"
+                               (file-name-nondirectory file) (or pct 0)
+                               (if (> queued 1) (format " (+%d)" (1- queued)) "")))
+                 ((> queued 0) (format "%d queued" queued))
+                 (transmit--connecting "connecting")
+                 (t "")))))
+
+(defun transmit--publish-status ()
+  "Recompute the status; redraw and run the status hook only if it changed."
+  (let ((status (transmit--compute-status)))
+    (unless (equal status transmit--status)
+      (setq transmit--status status
+            transmit--modeline-string nil)
+      (force-mode-line-update t)
+      (run-hook-with-args 'transmit-status-functions status))))
+
+(defun transmit--render-modeline (status)
+  "Return the modeline string for STATUS."
+  (let* ((server (plist-get status :server))
+         (file (plist-get status :file))
+         (pct (or (plist-get status :percent) 0))
+         (queue-len (plist-get status :queued))
          (map (make-sparse-keymap)))
     (define-key map [mode-line mouse-1] #'transmit-show-queue-popup)
     (define-key map [mode-line mouse-3] #'transmit-show-queue-popup)
     (propertize
      (concat
       " ⇪ "
-      (if transmit--active-server
+      (if server
           (propertize
-           (format "%s→%s" transmit--active-server transmit--active-remote)
-           'face (if transmit--connection-ready
+           (format "%s→%s" server (plist-get status :remote))
+           'face (if (plist-get status :connected)
                      '(:foreground "#88c0d0" :weight bold)
                    '(:foreground "#616e88")))
         (propertize "no server" 'face '(:foreground "#4c566a")))
@@ -485,16 +897,37 @@ When nil the binary is found automatically."
       " ")
      'mouse-face 'mode-line-highlight
      'local-map map
-     'help-echo (if transmit--active-server
+     'help-echo (if server
                     (format "SFTP: %s → %s | %d queued\nClick to show queue"
-                            transmit--active-server
-                            transmit--active-remote
+                            server
+                            (plist-get status :remote)
                             queue-len)
                   "SFTP: no server selected\nClick to configure"))))
 
+(defun transmit--modeline-segment ()
+  "Return the transmit modeline string, rendered once per status change."
+  (or transmit--modeline-string
+      (setq transmit--modeline-string
+            (transmit--render-modeline
+             (or transmit--status
+                 (setq transmit--status (transmit--compute-status)))))))
+
 (defun transmit--modeline-refresh ()
-  "Force modeline to redisplay."
-  (force-mode-line-update t))
+  "Publish the current status now."
+  (transmit--publish-status))
+
+(defconst transmit--redisplay-interval 0.2
+  "Minimum seconds between modeline/popup refreshes driven by helper output.")
+
+(defun transmit--request-redisplay ()
+  "Refresh the modeline and queue popup soon, coalescing bursts of updates."
+  (unless transmit--redisplay-timer
+    (setq transmit--redisplay-timer
+          (run-with-timer transmit--redisplay-interval nil
+                          (lambda ()
+                            (setq transmit--redisplay-timer nil)
+                            (transmit--modeline-refresh)
+                            (transmit--maybe-refresh-queue-buffer))))))
 
 (defun transmit--modeline-progress-bar (pct width)
   "Return a progress bar string of WIDTH chars at PCT percent."
@@ -580,7 +1013,8 @@ When nil the binary is found automatically."
                         (propertize (transmit--modeline-progress-bar pct 30)
                                     'face '(:foreground "#a3be8c"))
                         pct))))
-    (let ((pending (cl-remove-if (lambda (i) (plist-get i :processing)) transmit--queue)))
+    (let ((pending (cl-remove-if (lambda (i) (plist-get i :processing))
+                                 (transmit--queue-items))))
       (if (null pending)
           (insert (propertize " Queue is empty.\n" 'face '(:foreground "#616e88")))
         (insert (propertize (format " Queued (%d):\n" (length pending))
@@ -606,43 +1040,117 @@ When nil the binary is found automatically."
 
 ;;;; ---- Process: command dispatch --------------------------------------------
 
+(defun transmit--remote-base (root)
+  "Return the remote base path selected for project ROOT, or nil.
+Memoised until transmit.json or the server config changes."
+  (let ((data (transmit--read-data)))
+    (or (gethash root transmit--remote-bases)
+        (let* ((entry (and data (gethash root data)))
+               (server (and entry (gethash "server_name" entry)))
+               (rname (and entry (gethash "remote" entry)))
+               (cfg (and server (gethash server transmit--server-config)))
+               (remotes (and cfg (gethash "remotes" cfg)))
+               (rbase (and remotes rname (gethash rname remotes))))
+          (when rbase
+            (puthash root rbase transmit--remote-bases))))))
+
+(defun transmit--remote-path (path &optional dir)
+  "Return the remote path for local PATH in the project containing DIR.
+Returns nil when the project has no server and remote selected."
+  (let* ((root (transmit--project-root dir))
+         (rbase (transmit--remote-base root)))
+    (when rbase
+      (if (string= (file-name-as-directory (expand-file-name path))
+                   (file-name-as-directory root))
+          rbase
+        (concat rbase "/" (file-relative-name path root))))))
+
+(defun transmit--define-copy-endpoints (item)
+  "Make sure the helper knows both servers of copy ITEM.
+Returns an error message if the copy can't be sent."
+  (cl-block transmit--define-copy-endpoints
+    (when (< transmit--helper-protocol 7)
+      (cl-return-from transmit--define-copy-endpoints
+        "The transmit helper is too old for remote-to-remote copies"))
+    (dolist (spec (list (plist-get item :filename) (plist-get item :target)))
+      (let* ((name (and (string-match "\\`\\([^:]+\\):" spec) (match-string 1 spec)))
+             (cfg (and name (gethash name transmit--server-config)))
+             (creds (and cfg (gethash "credentials" cfg))))
+        (unless creds
+          (cl-return-from transmit--define-copy-endpoints
+            (format "Unknown server in %s" spec)))
+        (when (equal (gethash "auth_type" creds) "password")
+          (cl-return-from transmit--define-copy-endpoints
+            (format "Copies need key or agent authentication for %s" name)))
+        (unless (gethash name transmit--defined)
+          (let ((method (if (equal (gethash "auth_type" creds) "agent") "agent" "key"))
+                (key (gethash "identity_file" creds)))
+            (transmit--send transmit--process
+                            (format "define %s %s@%s %s %s\n"
+                                    name (gethash "username" creds) (gethash "host" creds)
+                                    method (if key (expand-file-name key) "")))
+            (puthash name t transmit--defined)))))
+    nil))
+
 (defun transmit--process-next ()
-  "Send the head of the queue to the live SFTP process."
+  "Send queued items to the live SFTP process while the credit window allows.
+Called on every completion and credit grant, so throughput is set by the
+helper rather than by a timer."
   (cl-block transmit--process-next
     (unless (and transmit--process (process-live-p transmit--process))
       (transmit--log 2 "process-next: process not alive, aborting")
       (cl-return-from transmit--process-next nil))
-    (let ((item (transmit--queue-head)))
-      (when (and item (not (plist-get item :processing)))
-        (let* ((cwd (plist-get item :working-dir))
+    ;; Items already sent always form the head of the queue.
+    (let ((rest (transmit--next-unsent)))
+      (while (and rest (transmit--has-send-budget-p))
+        (let* ((item (car rest))
+               (cwd (plist-get item :working-dir))
                (filename (plist-get item :filename))
-               (cfg (transmit--get-server-config cwd))
-               (data (transmit--read-data))
-               (root (transmit--project-root cwd))
-               (entry (and data (gethash root data)))
-               (rname (and entry (gethash "remote" entry)))
-               (remotes (and cfg (gethash "remotes" cfg)))
-               (rbase (and remotes rname (gethash rname remotes))))
-          (unless (and cfg rbase)
-            (transmit--log 4 (format "No remote configured for %s" cwd) t)
-            (transmit--dequeue)
-            (cl-return-from transmit--process-next nil))
-          (let* ((relative (file-relative-name filename root))
-                 (remote-path (concat rbase "/" relative))
-                 (cmd (cl-case (intern (plist-get item :type))
-                        (upload (format "upload %s %s\n" filename remote-path))
-                        (remove (format "remove %s\n" remote-path)))))
-            (when cmd
-              (plist-put item :processing t)
-              (plist-put item :started-at (float-time))
-              (transmit--start-modeline-timer)
-              (transmit--log 1 (format "Sending: %s" (string-trim cmd)))
-              (condition-case err
-                  (process-send-string transmit--process cmd)
-                (error
-                 (transmit--log 4 (format "Failed to send command: %s" err))
-                 (plist-put item :processing nil)
-                 (plist-put item :started-at nil))))))))))
+               (copy (string= (plist-get item :type) "copy"))
+               (item-error
+                (cond (copy (transmit--define-copy-endpoints item))
+                      ((and (string= (plist-get item :type) "release")
+                            (< transmit--helper-protocol 8))
+                       "The transmit helper is too old for releases")))
+               ;; Both ends of a copy are already remote
+               (remote-path (cond (item-error nil)
+                                  (copy (plist-get item :target))
+                                  (t (transmit--remote-path filename cwd))))
+               (flow (if (>= transmit--helper-protocol 5)
+                         ;; Lets the helper schedule a sync in one project
+                         ;; fairly against saves and other projects
+                         (format " %s:%s" (if (plist-get item :bulk) "bulk" "save") cwd)
+                       ""))
+               (cmd (and remote-path
+                         (cl-case (intern (plist-get item :type))
+                           (upload (format "upload %s %s%s\n" filename remote-path flow))
+                           (remove (format "remove %s%s\n" remote-path flow))
+                           (copy (format "copy %s %s%s\n" filename remote-path flow))
+                           (release (format "release %s %s%s\n"
+                                            (plist-get item :action) remote-path flow))))))
+          (cond
+           ((not remote-path)
+            (transmit--log 4 (or item-error (format "No remote configured for %s" cwd)) t)
+            (transmit--cancel-queue-item (plist-get item :id))
+            (transmit--modeline-refresh))
+           (cmd
+            (plist-put item :processing t)
+            (plist-put item :started-at (float-time))
+            (plist-put item :remote-path remote-path)
+            (transmit--queue-changed)
+            (transmit--unindex-pending item)
+            (setq transmit--queue-sent rest)
+            (cl-decf transmit--credits)
+            (transmit--start-watchdog)
+            (transmit--log 1 (format "Sending: %s" (string-trim cmd)))
+            (condition-case err
+                (process-send-string transmit--process cmd)
+              (error
+               (transmit--log 4 (format "Failed to send command: %s" err))
+               (cl-incf transmit--credits)
+               (transmit--requeue-in-flight)
+               (setq rest nil)))))
+          (setq rest (and rest (transmit--next-unsent))))))))
 
 ;;;; ---- Process: output filter -----------------------------------------------
 
@@ -651,45 +1159,44 @@ When nil the binary is found automatically."
   (transmit--log 1 (format "> %s" (string-trim text)))
   (process-send-string proc text))
 
-(defun transmit--check-prompt (proc cfg)
-  "Check the incomplete accumulation buffer for handshake prompts and respond."
-  (let ((buf transmit--process-buf)
-        (creds (and cfg (gethash "credentials" cfg))))
+(defun transmit--check-prompt (proc cfg pending)
+  "Answer a handshake prompt found in PENDING, the unterminated output tail.
+Returns non-nil when a prompt was answered."
+  (let ((creds (and cfg (gethash "credentials" cfg))))
     (cond
      ((and (string= transmit--phase transmit--phase-init)
-           (string-match-p "Enter SSH hostname" buf))
+           (string-match-p "Enter SSH hostname" pending))
       (transmit--send proc (concat (gethash "host" creds) "\n"))
-      (setq transmit--phase transmit--phase-username)
-      (setq transmit--process-buf ""))
+      (setq transmit--phase transmit--phase-username))
      ((and (string= transmit--phase transmit--phase-username)
-           (string-match-p "Enter SSH username" buf))
+           (string-match-p "Enter SSH username" pending))
       (transmit--send proc (concat (gethash "username" creds) "\n"))
-      (setq transmit--phase transmit--phase-auth-method)
-      (setq transmit--process-buf ""))
+      (setq transmit--phase transmit--phase-auth-method))
      ((and (string= transmit--phase transmit--phase-auth-method)
-           (string-match-p "Authentication method" buf))
+           (string-match-p "Authentication method" pending))
       (let ((auth-type (or (gethash "auth_type" creds) "key")))
         (transmit--send proc (concat auth-type "\n"))
         (setq transmit--phase
-              (if (string= auth-type "password")
-                  transmit--phase-password
-                transmit--phase-key))
-        (setq transmit--process-buf "")))
+              (cond ((string= auth-type "password") transmit--phase-password)
+                    ;; Keys come from ssh-agent; nothing more to send.
+                    ((string= auth-type "agent") transmit--phase-ready)
+                    (t transmit--phase-key)))))
      ((and (string= transmit--phase transmit--phase-password)
-           (string-match-p "Enter password" buf))
+           (string-match-p "Enter password" pending))
       (transmit--send proc (concat (gethash "password" creds) "\n"))
-      (setq transmit--phase transmit--phase-ready)
-      (setq transmit--process-buf ""))
+      (setq transmit--phase transmit--phase-ready))
      ((and (string= transmit--phase transmit--phase-key)
-           (string-match-p "Enter path to private key" buf))
+           (string-match-p "Enter path to private key" pending))
       (transmit--send proc (concat (expand-file-name (gethash "identity_file" creds)) "\n"))
-      (setq transmit--phase transmit--phase-ready)
-      (setq transmit--process-buf "")))))
+      (setq transmit--phase transmit--phase-ready)))))
 
 (defun transmit--handle-line (line)
   "Handle a complete newline-terminated LINE from the binary."
-  (transmit--log 1 (format "< %s" line))
+  (when (<= transmit-log-level 1)
+    (transmit--log 1 (format "< %s" line)))
   (cond
+   ((string-match "^PROTOCOL|\\([0-9]+\\)" line)
+    (setq transmit--helper-protocol (string-to-number (match-string 1 line))))
    ((and (string= transmit--phase transmit--phase-ready)
          (string-match-p "Connected to" line))
     (setq transmit--phase transmit--phase-active
@@ -698,24 +1205,112 @@ When nil the binary is found automatically."
     (transmit--stop-auth-timeout)
     (transmit--log 2 "SFTP connection established" t)
     (transmit--modeline-refresh)
+    ;; Before anything is sent, so the first batch already counts
+    (transmit--register-hooks)
+    (transmit--flush-prewarm)
     (when transmit--pending-callback
       (let ((cb transmit--pending-callback))
         (setq transmit--pending-callback nil)
-        (run-at-time 0.3 nil cb))))
+        (funcall cb))))
    ((and (string= transmit--phase transmit--phase-active)
          (string-match-p "Connected to" line))
     nil)
    ((and (string= transmit--phase transmit--phase-active)
          (string-match "^PROGRESS|\\(.*\\)|\\([0-9]+\\)$" line))
+    ;; Only reached when the file changes; repeats for the same file are
+    ;; parsed in place by `transmit--handle-progress'.
     (let ((file (match-string 1 line))
           (pct (string-to-number (match-string 2 line))))
       (when (and file (>= pct 0) (<= pct 100))
-        (setq transmit--current-progress (list :file file :percent pct))
-        (transmit--modeline-refresh)
-        (transmit--maybe-refresh-queue-buffer))))
+        (setq transmit--current-progress (list :file file :percent pct)
+              transmit--progress-prefix (concat "PROGRESS|" (regexp-quote file) "|"))
+        (transmit--request-redisplay))))
+   ((and (string= transmit--phase transmit--phase-active)
+         (string-match "^RECONNECT|\\([0-9]+\\)|\\([0-9]+\\)" line))
+    ;; The helper is reconnecting on its own; keep the in-flight item from
+    ;; looking stalled to the watchdog while it backs off.
+    (let ((attempt (string-to-number (match-string 1 line)))
+          (head (transmit--queue-head)))
+      (when (and head (plist-get head :processing))
+        (plist-put head :started-at (float-time)))
+      (transmit--log 3 (format "SFTP link dropped, helper reconnecting (attempt %d, %sms)"
+                               attempt (match-string 2 line))
+                     (= attempt 1))))
+   ((and (string= transmit--phase transmit--phase-active)
+         (string-prefix-p "RECONNECTED|" line))
+    (transmit--log 2 "SFTP session re-established by helper" t)
+    (transmit--modeline-refresh))
+   ((and (string= transmit--phase transmit--phase-active)
+         (string-prefix-p "FAILOVER|" line))
+    (transmit--log 2 "SFTP link dropped, switched to standby session" t))
+   ((and (string= transmit--phase transmit--phase-active)
+         (string-prefix-p "IDLE|" line))
+    (transmit--log 2 "SFTP session idle, helper dropped it until next use"))
+   ((and (string= transmit--phase transmit--phase-active)
+         (string-match "^CREDIT|\\([0-9]+\\)" line))
+    ;; The helper hands back one credit per finished command; sending only
+    ;; within the grant keeps its stdin bounded during large syncs.
+    (setq transmit--credit-based t)
+    (cl-incf transmit--credits (string-to-number (match-string 1 line)))
+    (transmit--process-next))
+   ((and (string= transmit--phase transmit--phase-active)
+         (string-match "^REPLAY|\\([a-z]+\\)|\\([a-z]+\\)|\\([^|]*\\)" line))
+    (let ((status (match-string 1 line)))
+      (transmit--log (if (string= status "failed") 3 2)
+                     (format "Resumed %s of %s from journal: %s"
+                             (match-string 2 line) (match-string 3 line) status)
+                     (string= status "failed"))
+      ;; Failed ones are still wanted; they go out with the resends
+      (unless (string= status "failed")
+        (puthash (format "%s|%s" (match-string 2 line) (match-string 3 line))
+                 t transmit--replayed))))
+   ((and (string= transmit--phase transmit--phase-active)
+         (string-prefix-p "REPLAYED|" line))
+    (transmit--settle-replayed)
+    (transmit--process-next))
+   ((and (string= transmit--phase transmit--phase-active)
+         (string-match "^PREWARM|\\([a-z]+\\)|\\(.*\\)$" line))
+    (transmit--log 1 (format "Prewarm %s: %s" (match-string 2 line) (match-string 1 line))))
+   ((and (string= transmit--phase transmit--phase-active)
+         (string-match "^DEFINE|\\([^|]*\\)|failed|\\(.*\\)$" line))
+    (remhash (match-string 1 line) transmit--defined)
+    (transmit--log 4 (format "Helper rejected server %s: %s"
+                             (match-string 1 line) (match-string 2 line))
+                   t))
+   ((and (string= transmit--phase transmit--phase-active)
+         (string-match "^HOOK|\\([^|]*\\)|ran|\\(-?[0-9]+\\)|\\([0-9]+\\)|\\(.*\\)$" line))
+    (let* ((root (match-string 1 line))
+           (status (string-to-number (match-string 2 line)))
+           (run (list :root root
+                      :status status
+                      :duration-ms (string-to-number (match-string 3 line))
+                      :output (match-string 4 line)
+                      :finished-at (float-time))))
+      (puthash root run transmit--hook-runs)
+      (setq transmit--last-hook run)
+      (transmit--modeline-refresh)
+      (transmit--log (if (= status 0) 2 4)
+                     (format "Hook for %s exited %d after %d ms%s" root status
+                             (plist-get run :duration-ms)
+                             (if (string-empty-p (plist-get run :output)) ""
+                               (concat ": " (plist-get run :output))))
+                     (/= status 0))))
+   ((and (string= transmit--phase transmit--phase-active)
+         (string-match "^HOOK|\\([^|]*\\)|rejected|\\(.*\\)$" line))
+    (transmit--log 4 (format "Helper rejected hook for %s: %s"
+                             (match-string 1 line) (match-string 2 line))
+                   t))
+   ((and (string= transmit--phase transmit--phase-active)
+         (string-match "^RELEASE|\\([a-z]+\\)|\\([^|]*\\)|\\(.*\\)$" line))
+    (let ((status (match-string 1 line)))
+      (transmit--log 2 (format "Release %s for %s: %s"
+                               status (match-string 2 line) (match-string 3 line))
+                     (string= status "live"))))
    ((and (string= transmit--phase transmit--phase-active)
          (or (string-match-p "^1|Upload succeeded" line)
              (string-match-p "^1|Remove succeeded" line)
+             (string-match-p "^1|Copy succeeded" line)
+             (string-match-p "^1|Release succeeded" line)
              (string-match-p "^0|" line)))
     (let ((item (transmit--queue-head)))
       (when (and item (plist-get item :processing))
@@ -723,58 +1318,127 @@ When nil the binary is found automatically."
                                  (plist-get item :type)
                                  (plist-get item :filename)))
         (transmit--dequeue)
-        (setq transmit--current-progress (list :file nil :percent nil))
-        (transmit--reset-keepalive)
-        (transmit--maybe-refresh-queue-buffer)
-        (if transmit--queue
-            (run-at-time 0.5 nil #'transmit--process-next)
-          (transmit--stop-modeline-timer)
+        (setq transmit--current-progress (list :file nil :percent nil)
+              transmit--progress-prefix nil)
+        (transmit--request-redisplay)
+        (if (> transmit--queue-count 0)
+            (transmit--process-next)
+          (transmit--stop-watchdog)
           (transmit--modeline-refresh)
           (message "Transmit: All transfers complete")))))))
 
+(defun transmit--handle-progress (eol)
+  "Update progress from the PROGRESS line at point ending at EOL, in place.
+Returns non-nil if the line repeated the current file and was consumed
+without allocating strings."
+  (when (and transmit--progress-prefix
+             (string= transmit--phase transmit--phase-active)
+             (looking-at transmit--progress-prefix))
+    (let ((pos (match-end 0))
+          (pct 0))
+      (while (and pct (< pos eol))
+        (let ((c (char-after pos)))
+          (setq pct (and (<= ?0 c ?9) (+ (* pct 10) (- c ?0)))
+                pos (1+ pos))))
+      (when (and pct (< (match-end 0) eol) (<= pct 100))
+        (unless (eql pct (plist-get transmit--current-progress :percent))
+          (plist-put transmit--current-progress :percent pct)
+          (transmit--request-redisplay))
+        t))))
+
 (defun transmit--filter (proc string)
-  "Accumulate output STRING from PROC and drive the state machine."
-  (setq transmit--process-buf (concat transmit--process-buf string))
-  (let ((cfg (transmit--get-server-config)))
-    (unless (string= transmit--phase transmit--phase-active)
-      (transmit--check-prompt proc cfg))
-    (while (string-match "\n" transmit--process-buf)
-      (let* ((pos (match-beginning 0))
-             (line (substring transmit--process-buf 0 pos)))
-        (setq transmit--process-buf (substring transmit--process-buf (1+ pos)))
-        (unless (string= (string-trim line) "")
-          (transmit--handle-line (string-trim line)))))))
+  "Append output STRING from PROC to its buffer and handle complete lines.
+Lines are parsed by position in the process buffer; consumed text is
+deleted once per chunk."
+  (let ((buf (process-buffer proc)))
+    (when (buffer-live-p buf)
+      (with-current-buffer buf
+        (goto-char (point-max))
+        (insert string)
+        (goto-char (point-min))
+        (let ((start (point)))
+          (while (and (buffer-live-p buf) (search-forward "\n" nil t))
+            (let ((eol (1- (point))))
+              (goto-char start)
+              (cond
+               ((= start eol))
+               ((transmit--handle-progress eol))
+               (t
+                (transmit--handle-line
+                 (string-trim-right (buffer-substring-no-properties start eol)))))
+              ;; Handlers may switch buffers or kill this one
+              (when (buffer-live-p buf)
+                (set-buffer buf)
+                (goto-char (1+ eol))
+                (setq start (point)))))
+          (when (buffer-live-p buf)
+            (delete-region (point-min) start)))
+        (when (and (buffer-live-p buf)
+                   (not (string= transmit--phase transmit--phase-active)))
+          (when (transmit--check-prompt proc (process-get proc 'transmit-config)
+                                        (buffer-string))
+            (erase-buffer)))))))
 
 ;;;; ---- Process: sentinel ----------------------------------------------------
 
-(defun transmit--sentinel (_proc event)
-  "Handle process lifecycle EVENT."
+(defun transmit--sentinel (proc event)
+  "Handle process lifecycle EVENT of PROC."
   (transmit--log 3 (format "Process event: %s" (string-trim event)))
+  (when (and (memq (process-status proc) '(exit signal))
+             (buffer-live-p (process-buffer proc)))
+    (kill-buffer (process-buffer proc)))
+  (clrhash transmit--prewarmed)
+  (clrhash transmit--defined)
   (setq transmit--connection-ready nil
         transmit--process nil
         transmit--connecting nil
+        transmit--helper-protocol 0
+        transmit--credits 0
+        transmit--credit-based nil
         transmit--current-progress (list :file nil :percent nil))
   (transmit--stop-auth-timeout)
-  (transmit--stop-modeline-timer)
+  (transmit--stop-watchdog)
   (transmit--modeline-refresh)
   (unless transmit--is-exiting
     (transmit--log 3 "SFTP connection lost, reconnecting..." t)
-    (dolist (item transmit--queue)
-      (plist-put item :processing nil)
-      (plist-put item :started-at nil))
+    (transmit--requeue-in-flight)
     (run-with-timer transmit-reconnect-delay nil
                     (lambda ()
                       (transmit--ensure-connection #'transmit--process-next)))))
 
 ;;;; ---- Connection lifecycle -------------------------------------------------
 
+(defun transmit--helper-command (binary cfg)
+  "Return the command line that starts BINARY for server config CFG."
+  (append (list binary
+                ;; The helper owns the idle policy: keepalives hold the
+                ;; session open and it is only dropped after a long idle.
+                "--keepalive" (number-to-string transmit-ssh-keepalive-interval)
+                "--idle-timeout" (number-to-string transmit-keepalive-timeout)
+                "--save-latency" (number-to-string transmit-save-latency))
+          ;; A warm spare session lets a dropped link fail over instantly.
+          (when (eq (gethash "standby" cfg) t) '("--standby"))
+          (when transmit-journal
+            (list "--journal" (transmit--account-file cfg "journal")))
+          ;; Server capabilities are probed once and reused while the host
+          ;; key stays the same.
+          (list "--capabilities" (transmit--account-file cfg "caps"))))
+
+(defun transmit--account-file (cfg extension)
+  "Return the helper state file with EXTENSION for the account in CFG."
+  (let* ((creds (gethash "credentials" cfg))
+         (account (replace-regexp-in-string
+                   "[^[:alnum:].@_-]" "_"
+                   (format "%s@%s" (gethash "username" creds) (gethash "host" creds)))))
+    (expand-file-name (format "transmit-%s.%s" account extension)
+                      (file-name-directory transmit-data-file))))
+
 (defun transmit--ensure-connection (&optional callback)
   "Ensure an SFTP connection is live, then call CALLBACK."
   (cl-block transmit--ensure-connection
     (cond
      ((and transmit--process transmit--connection-ready)
-      (when callback (funcall callback))
-      (transmit--reset-keepalive))
+      (when callback (funcall callback)))
      (transmit--connecting
       (when callback
         (let ((prev transmit--pending-callback))
@@ -793,9 +1457,13 @@ When nil the binary is found automatically."
         (let ((binary (transmit--binary-path)))
           (unless binary
             (cl-return-from transmit--ensure-connection nil))
+          (clrhash transmit--replayed)
           (setq transmit--connecting t
                 transmit--phase transmit--phase-init
-                transmit--process-buf ""
+                transmit--progress-prefix nil
+                transmit--credits 0
+                transmit--credit-based nil
+                transmit--replay-settled nil
                 transmit--pending-callback callback)
           (transmit--start-auth-timeout)
           (transmit--modeline-refresh)
@@ -805,12 +1473,92 @@ When nil the binary is found automatically."
           (setq transmit--process
                 (make-process
                  :name "transmit"
-                 :buffer nil
-                 :command (list binary)
-                 :connection-type 'pty
+                 :buffer (with-current-buffer
+                             (generate-new-buffer transmit--process-buffer-name)
+                           (buffer-disable-undo)
+                           (setq-local case-fold-search nil)
+                           (current-buffer))
+                 :command (transmit--helper-command binary cfg)
+                 ;; A pipe avoids the pty line discipline and echo; the
+                 ;; helper flushes its prompts and progress explicitly.
+                 :connection-type 'pipe
+                 :coding 'utf-8-unix
                  :filter #'transmit--filter
                  :sentinel #'transmit--sentinel
-                 :noquery t))))))))
+                 :noquery t))
+          (process-put transmit--process 'transmit-config cfg)))))))
+
+;;;; ---- Focus ----------------------------------------------------------------
+
+(defun transmit--focus-changed ()
+  "Ask the helper to revive a stale session when Emacs regains focus."
+  (when (and transmit-reconnect-on-focus
+             transmit--process
+             transmit--connection-ready
+             (>= transmit--helper-protocol 2)
+             (cl-some #'frame-focus-state (frame-list)))
+    (condition-case nil
+        (process-send-string transmit--process "focus\n")
+      (error nil))))
+
+;;;; ---- Server hooks ---------------------------------------------------------
+
+(defun transmit--register-hooks ()
+  "Register the active server's hooks with a freshly connected helper.
+A remote's commands run as one && chain, once per batch of transfers."
+  (let* ((cfg (and transmit--process (process-get transmit--process 'transmit-config)))
+         (hooks (and cfg (gethash "hooks" cfg)))
+         (remotes (and cfg (gethash "remotes" cfg)))
+         (quiet-ms (round (* 1000 (or (and cfg (gethash "hook_quiet_period" cfg))
+                                      transmit-hook-quiet-period)))))
+    (when (and hooks transmit--process (>= transmit--helper-protocol 9))
+      (maphash
+       (lambda (remote commands)
+         (let ((root (and remotes (gethash remote remotes)))
+               (command (if (listp commands) (mapconcat #'identity commands " && ") commands)))
+           (if (not root)
+               (transmit--log 3 (format "Hook configured for unknown remote %s" remote) t)
+             (condition-case nil
+                 (transmit--send transmit--process
+                                 (format "hook %s %d %s\n" root quiet-ms
+                                         (replace-regexp-in-string "\n" " " command)))
+               (error nil)))))
+       hooks))))
+
+;;;; ---- Prewarm --------------------------------------------------------------
+
+(defun transmit--flush-prewarm ()
+  "Send pending prewarm hints to a connected helper."
+  (let ((pending transmit--prewarm-pending))
+    (setq transmit--prewarm-pending nil)
+    ;; Older helpers answer unknown commands with a 0| line, which would be
+    ;; taken as the completion of the upload in flight.
+    (when (and transmit--process
+               transmit--connection-ready
+               (>= transmit--helper-protocol 3))
+      (dolist (remote-dir (nreverse pending))
+        (unless (gethash remote-dir transmit--prewarmed)
+          (puthash remote-dir t transmit--prewarmed)
+          (condition-case nil
+              (transmit--send transmit--process (format "prewarm %s\n" remote-dir))
+            (error nil)))))))
+
+(defun transmit--prewarm (&optional file dir)
+  "Connect early and have the helper cache the remote directory of FILE.
+FILE defaults to the root of the project containing DIR."
+  (when (and transmit-prewarm (transmit--working-dir-has-selection-p dir))
+    (let* ((local-dir (if file (file-name-directory file) (transmit--project-root dir)))
+           (remote-dir (transmit--remote-path (directory-file-name local-dir) dir)))
+      (when (and remote-dir (not (gethash remote-dir transmit--prewarmed)))
+        (cl-pushnew remote-dir transmit--prewarm-pending :test #'string=)
+        (transmit--ensure-connection #'transmit--flush-prewarm)))))
+
+(defun transmit--prewarm-buffer (&optional _frame)
+  "Prewarm the remote directory of the selected window's file buffer."
+  (let ((file (buffer-file-name (window-buffer (selected-window)))))
+    (when (and file (not (transmit--excluded-p file)))
+      (with-current-buffer (window-buffer (selected-window))
+        (transmit--prewarm (expand-file-name file) default-directory)))))
 
 ;;;; ---- File exclusion -------------------------------------------------------
 
@@ -844,17 +1592,17 @@ When nil the binary is found automatically."
                                                         dir err)))))))))
           (when (file-regular-p file)
             (let ((root (transmit--find-watch-root file)))
-              (when root (transmit--enqueue "upload" file root))))))
+              (when root (transmit--enqueue "upload" file root t))))))
        ((eq action 'deleted)
         (unless (transmit--recently-uploaded-p file)
           (let ((root (transmit--find-watch-root file)))
-            (when root (transmit--enqueue "remove" file root)))))
+            (when root (transmit--enqueue "remove" file root t)))))
        ((eq action 'changed)
         (when (and (file-regular-p file)
                    (not (transmit--excluded-p file))
                    (not (transmit--recently-uploaded-p file)))
           (let ((root (transmit--find-watch-root file)))
-            (when root (transmit--enqueue "upload" file root)))))))))
+            (when root (transmit--enqueue "upload" file root t)))))))))
 
 (defun transmit--find-watch-root (file)
   "Return the watch root that FILE lives under, or nil."
@@ -919,8 +1667,9 @@ When nil the binary is found automatically."
 
 ;;;; ---- High-level file operations ------------------------------------------
 
-(defun transmit--upload (file &optional working-dir)
-  "Queue FILE for upload. Returns queue-item ID or nil."
+(defun transmit--upload (file &optional working-dir bulk)
+  "Queue FILE for upload. Returns queue-item ID or nil.
+BULK is passed on to `transmit--enqueue'."
   (cl-block transmit--upload
     (let* ((f (or file (buffer-file-name)))
            (root (transmit--project-root (or working-dir default-directory))))
@@ -933,7 +1682,7 @@ When nil the binary is found automatically."
       (unless (transmit--working-dir-has-selection-p root)
         (message "Transmit: no server configured for project %s" root)
         (cl-return-from transmit--upload nil))
-      (transmit--enqueue "upload" (expand-file-name f) root))))
+      (transmit--enqueue "upload" (expand-file-name f) root bulk))))
 
 (defun transmit--remove (file &optional working-dir)
   "Queue FILE for remote removal. Returns queue-item ID or nil."
@@ -1004,6 +1753,7 @@ When nil the binary is found automatically."
             (message "Transmit: server selection cleared"))
         (transmit--update-selection server-name remote)
         (transmit--install-auto-upload-hook)
+        (transmit--prewarm)
         (message "Transmit: using %s → %s" server-name remote)))))
 
 ;;;###autoload
@@ -1034,7 +1784,7 @@ When nil the binary is found automatically."
       (dolist (rel files)
         (let ((abs (expand-file-name rel root)))
           (when (file-regular-p abs)
-            (transmit--upload abs root)
+            (transmit--upload abs root t)
             (cl-incf count))))
       (message "Transmit: queued %d modified/untracked file(s)" count))))
 
@@ -1049,6 +1799,39 @@ When nil the binary is found automatically."
       (message "Transmit: queued remove [%d] %s"
                id (file-name-nondirectory buffer-file-name)))))
 
+;;;###autoload
+(defun transmit-copy (source target)
+  "Copy SOURCE to TARGET, both \"server:path\", between configured servers.
+The helper streams the data from one server to the other, so nothing is
+downloaded to this machine.  SOURCE may be a file or a directory."
+  (interactive
+   (let ((servers (hash-table-keys transmit--server-config)))
+     (list (concat (completing-read "Copy from server: " servers nil t) ":"
+                   (read-string "Source path: "))
+           (concat (completing-read "Copy to server: " servers nil t) ":"
+                   (read-string "Destination path: ")))))
+  (dolist (spec (list source target))
+    (unless (and (string-match "\\`\\([^:]+\\):." spec)
+                 (gethash (match-string 1 spec) transmit--server-config))
+      (user-error "Expected a configured server:path, got %s" spec)))
+  (let ((id (transmit--enqueue-copy source target)))
+    (message "Transmit: queued copy [%d] %s -> %s" id source target)))
+
+;;;###autoload
+(defun transmit-release (action)
+  "Run release step ACTION (\"begin\", \"commit\" or \"abort\") for this project.
+The project's remote must be a symlink such as /srv/app/current.  After
+\"begin\" uploads and removes land in a new directory under releases/ next
+to it, seeded with hardlinks of the live release; \"commit\" switches the
+symlink to it in one rename, and \"abort\" discards it."
+  (interactive
+   (list (completing-read "Release step: " '("begin" "commit" "abort") nil t)))
+  (unless (member action '("begin" "commit" "abort"))
+    (user-error "Unknown release step: %s" action))
+  (let* ((root (transmit--project-root))
+         (id (transmit--enqueue-release action root)))
+    (message "Transmit: queued release %s [%d] for %s" action id root)))
+
 ;;;###autoload
 (defun transmit-watch-directory ()
   "Watch the current project root for changes and auto-upload."
@@ -1080,8 +1863,8 @@ When nil the binary is found automatically."
 (defun transmit-clear-queue ()
   "Clear all pending (non-processing) items from the queue."
   (interactive)
-  (setq transmit--queue
-        (cl-remove-if-not (lambda (i) (plist-get i :processing)) transmit--queue))
+  (dolist (item transmit--queue)
+    (transmit--cancel-queue-item (plist-get item :id)))
   (transmit--modeline-refresh)
   (transmit--maybe-refresh-queue-buffer)
   (message "Transmit: queue cleared"))
@@ -1097,32 +1880,28 @@ When nil the binary is found automatically."
         transmit--connecting nil
         transmit--connection-ready nil
         transmit--current-progress (list :file nil :percent nil))
-  (dolist (item transmit--queue)
-    (plist-put item :processing nil)
-    (plist-put item :started-at nil))
-  (transmit--stop-modeline-timer)
+  (transmit--requeue-in-flight)
+  (transmit--stop-watchdog)
   (transmit--modeline-refresh)
   (transmit--maybe-refresh-queue-buffer)
   (message "Transmit: reset complete — %d item(s) remain in queue"
-           (length transmit--queue)))
+           transmit--queue-count))
 
 ;;;###autoload
 (defun transmit-retry ()
   "Retry all queued items without clearing them."
   (interactive)
-  (dolist (item transmit--queue)
-    (plist-put item :processing nil)
-    (plist-put item :started-at nil))
+  (transmit--requeue-in-flight)
   (setq transmit--connection-ready nil
         transmit--connecting nil)
   (when transmit--process
     (condition-case nil (delete-process transmit--process) (error nil))
     (setq transmit--process nil))
   (transmit--modeline-refresh)
-  (if transmit--queue
+  (if (> transmit--queue-count 0)
       (progn
         (transmit--ensure-connection #'transmit--process-next)
-        (message "Transmit: retrying %d item(s)" (length transmit--queue)))
+        (message "Transmit: retrying %d item(s)" transmit--queue-count))
     (message "Transmit: queue is empty — nothing to retry")))
 
 ;;;###autoload
@@ -1138,9 +1917,6 @@ When nil the binary is found automatically."
 (defun transmit-disconnect ()
   "Close the SFTP connection."
   (interactive)
-  (when transmit--keepalive-timer
-    (cancel-timer transmit--keepalive-timer)
-    (setq transmit--keepalive-timer nil))
   (when transmit--process
     (condition-case nil
         (process-send-string transmit--process "exit\n")
@@ -1162,23 +1938,34 @@ When nil the binary is found automatically."
   (interactive)
   (let* ((server (transmit--get-selected-server))
          (remote (transmit--get-selected-remote))
-         (q-len (length transmit--queue))
-         (processing (cl-count-if (lambda (i) (plist-get i :processing))
-                                   transmit--queue))
+         (q-len transmit--queue-count)
+         (processing (transmit--in-flight-count))
          (state (cond (transmit--connection-ready "connected")
                       (transmit--connecting       "connecting")
-                      (t                          "disconnected"))))
-    (message "Transmit: server=%s  remote=%s  state=%s  queue=%d  active=%d"
+                      (t                          "disconnected")))
+         (hook (and transmit--last-hook
+                    (format "  hook=%s exit %d in %d ms"
+                            (plist-get transmit--last-hook :root)
+                            (plist-get transmit--last-hook :status)
+                            (plist-get transmit--last-hook :duration-ms)))))
+    (message "Transmit: server=%s  remote=%s  state=%s  queue=%d  active=%d%s"
              (or server "none")
              (or remote "none")
              state
              q-len
-             processing)))
+             processing
+             (or hook ""))))
 
 (defun transmit-get-progress ()
   "Return the current upload progress as a plist with :file and :percent."
   transmit--current-progress)
 
+(defun transmit-get-status ()
+  "Return the last published status plist.
+See `transmit-status-functions' for its keys; treat it as read-only."
+  (or transmit--status
+      (setq transmit--status (transmit--compute-status))))
+
 ;;;; ---- Setup ----------------------------------------------------------------
 
 ;;;###autoload
@@ -1192,6 +1979,8 @@ When nil the binary is found automatically."
              (json-key-type 'string)
              (data (json-read-file expanded)))
         (clrhash transmit--server-config)
+        (clrhash transmit--project-roots)
+        (transmit--invalidate-data)
         (maphash (lambda (name cfg)
                    (puthash name cfg transmit--server-config))
                  data)
@@ -1202,6 +1991,12 @@ When nil the binary is found automatically."
             (setq transmit--active-server (car any)
                   transmit--active-remote (cdr any))))
         (transmit--install-auto-upload-hook)
+        (add-hook 'kill-emacs-hook #'transmit--save-queue)
+        ;; Anything a crashed session left unsent goes out first
+        (transmit--resume-queue)
+        (add-function :after after-focus-change-function #'transmit--focus-changed)
+        (add-hook 'window-buffer-change-functions #'transmit--prewarm-buffer)
+        (transmit--prewarm-buffer)
         (transmit--modeline-refresh)
         (transmit--log 2 (format "Loaded %d server(s) from %s"
                                   (hash-table-count transmit--server-config)
@@ -18,11 +18,11 @@ local EXCLUDED_PATTERNS = {
   "%.DS_Store$",      -- macOS metadata
 }
 
----Check if the current OS is Windows
----@return boolean is_windows True if running on Windows
-local function is_windows()
-  return package.config:sub(1, 1) == '\\'
-end
+-- Watch setup is spread over event-loop ticks so large trees don't freeze
+-- the editor: directories are listed on the libuv threadpool and watches
+-- registered in slices of at most REGISTER_SLICE_NS
+local SCAN_CONCURRENCY = 4
+local REGISTER_SLICE_NS = 4 * 1000 * 1000
 
 ---Check if a path matches any excluded pattern
 ---@param path string Path to check
@@ -138,12 +138,12 @@ local function on_change(path, root_directory, excluded_directories)
   if not exists then
     -- File was deleted
     vim.schedule(function()
-      util.remove_path(path, root_directory)
+      util.remove_path(path, root_directory, true)
     end)
   else
     -- File was created or modified
     vim.schedule(function()
-      util.upload_file(path, root_directory)
+      util.upload_file(path, root_directory, true)
     end)
   end
 end
@@ -210,32 +210,127 @@ function events.remove_all_watches_for_root(root_directory)
   return count
 end
 
----Get list of all subdirectories in a directory
----@param directory string Root directory to scan
----@return string[]|nil directories List of subdirectory paths or nil on error
-local function get_subdirectories(directory)
-  local command
-  if is_windows() then
-    command = 'dir "' .. directory .. '" /ad /b /s'
-  else
-    command = 'find "' .. directory .. '" -type d'
+---Walk a directory tree asynchronously, skipping excluded subtrees
+---@param root string Root directory to walk (reported first)
+---@param should_skip fun(dir: string): boolean Called before descending into a directory
+---@param on_directory fun(dir: string) Called for every directory to watch
+---@param on_done fun(skipped: number) Called once the walk has finished
+---@return nil
+local function scan_directories(root, should_skip, on_directory, on_done)
+  local uv = vim.uv or vim.loop
+  local pending = { root }
+  local in_flight = 0
+  local skipped = 0
+
+  local pump
+
+  local function add(child)
+    if should_skip(child) then
+      skipped = skipped + 1
+    else
+      table.insert(pending, child)
+    end
   end
-  
-  local handle = io.popen(command)
-  if not handle then
+
+  local function list(dir)
+    in_flight = in_flight + 1
+    uv.fs_scandir(dir, function(err, handle)
+      if not err and handle then
+        while true do
+          local name, kind = uv.fs_scandir_next(handle)
+          if not name then
+            break
+          end
+          local child = dir .. "/" .. name
+          -- Symlinked directories are not followed, so cycles can't occur
+          if kind == "directory" then
+            add(child)
+          elseif not kind then
+            -- The filesystem doesn't report entry types; ask without
+            -- blocking, as one scan in flight
+            in_flight = in_flight + 1
+            uv.fs_lstat(child, function(_, stat)
+              if stat and stat.type == "directory" then
+                add(child)
+              end
+              in_flight = in_flight - 1
+              pump()
+            end)
+          end
+        end
+      end
+      in_flight = in_flight - 1
+      pump()
+    end)
+  end
+
+  pump = function()
+    while in_flight < SCAN_CONCURRENCY and #pending > 0 do
+      local dir = table.remove(pending)
+      on_directory(dir)
+      list(dir)
+    end
+    if in_flight == 0 and #pending == 0 then
+      on_done(skipped)
+    end
+  end
+
+  pump()
+end
+
+---Start an fs_event watch on one directory
+---@param dir string Directory to watch
+---@param directory string Root directory being watched
+---@param excluded_directories string[] List of excluded directory patterns
+---@return uv_fs_event_t|nil handle The started handle, or nil on failure
+local function start_watch(dir, directory, excluded_directories)
+  local uv = vim.uv or vim.loop
+
+  -- FS event flags
+  local flags = {
+    watch_entry = false, -- When true, watch dir inode instead of dir content
+    stat = false,        -- When true, use periodic check instead of inotify/kqueue
+    recursive = false    -- Recursion handled manually for better control
+  }
+
+  local handle_event = uv.new_fs_event()
+
+  if not handle_event then
+    vim.notify("Failed to create fs_event handle for: " .. dir, vim.log.levels.WARN)
     return nil
   end
-  
-  local directories = {}
-  for dir in handle:lines() do
-    table.insert(directories, dir)
+
+  -- Callback for file system events
+  local callback = function(err, filename, event_info)
+    if err then
+      vim.schedule(function()
+        vim.notify("Watch error for " .. dir .. ": " .. err, vim.log.levels.WARN)
+      end)
+      remove_watch(dir, handle_event, directory)
+    else
+      if filename then
+        local full_path = dir .. "/" .. filename
+        on_change(full_path, directory, excluded_directories)
+      end
+    end
   end
-  
-  handle:close()
-  return directories
+
+  -- Start watching
+  local success, err = pcall(function()
+    uv.fs_event_start(handle_event, dir, flags, callback)
+  end)
+
+  if not success then
+    vim.notify("Failed to start watching " .. dir .. ": " .. tostring(err), vim.log.levels.WARN)
+    return nil
+  end
+
+  return handle_event
 end
 
 ---Watch a directory and all its subdirectories for changes
+---Setup is asynchronous: directories are enumerated off the main thread and
+---watches registered in time-sliced chunks; a summary is shown when done.
 ---@param directory string Root directory path to watch
 ---@param excluded_directories string[]|nil List of directory patterns to exclude
 ---@return boolean success Returns true if watching started successfully
@@ -261,82 +356,81 @@ function events.watch_directory_for_changes(directory, excluded_directories)
   end
   
   local uv = vim.uv or vim.loop
-  
-  -- Get all subdirectories
-  local directories = get_subdirectories(directory)
-  if not directories then
-    vim.notify("Failed to scan directory: " .. directory, vim.log.levels.ERROR)
-    return false
-  end
-  
-  -- FS event flags
-  local flags = {
-    watch_entry = false, -- When true, watch dir inode instead of dir content
-    stat = false,        -- When true, use periodic check instead of inotify/kqueue
-    recursive = false    -- Recursion handled manually for better control
-  }
-  
-  events.watching[directory] = {}
+  local watchers = {}
+  events.watching[directory] = watchers
+
+  local to_register = {}
   local watch_count = 0
+  local scan_done = false
   local excluded_count = 0
-  
-  -- Watch each directory
-  for _, dir in ipairs(directories) do
-    -- Skip excluded directories
-    if is_excluded_directory(dir, excluded_directories) or is_excluded_by_pattern(dir) then
-      excluded_count = excluded_count + 1
-      goto continue
+  local slice_scheduled = false
+
+  -- Stop quietly if the watch was removed while setup was still running
+  local function cancelled()
+    return events.watching[directory] ~= watchers
+  end
+
+  local function report()
+    vim.notify(
+      string.format("Watching %d director%s in: %s%s",
+        watch_count,
+        watch_count == 1 and "y" or "ies",
+        directory,
+        excluded_count > 0 and string.format(" (%d excluded)", excluded_count) or ""
+      ),
+      vim.log.levels.INFO
+    )
+  end
+
+  local register_slice
+
+  local function schedule_slice()
+    if not slice_scheduled then
+      slice_scheduled = true
+      vim.schedule(register_slice)
     end
-    
-    local handle_event = uv.new_fs_event()
-    
-    if not handle_event then
-      vim.notify("Failed to create fs_event handle for: " .. dir, vim.log.levels.WARN)
-      goto continue
+  end
+
+  register_slice = function()
+    slice_scheduled = false
+    if cancelled() then
+      return
     end
-    
-    -- Callback for file system events
-    local callback = function(err, filename, event_info)
-      if err then
-        vim.schedule(function()
-          vim.notify("Watch error for " .. dir .. ": " .. err, vim.log.levels.WARN)
-        end)
-        remove_watch(dir, handle_event, directory)
-      else
-        if filename then
-          local full_path = dir .. "/" .. filename
-          on_change(full_path, directory, excluded_directories)
-        end
+
+    local deadline = uv.hrtime() + REGISTER_SLICE_NS
+    while #to_register > 0 and uv.hrtime() < deadline do
+      local dir = table.remove(to_register)
+      local handle_event = start_watch(dir, directory, excluded_directories)
+      if handle_event then
+        watchers[dir] = handle_event
+        watch_count = watch_count + 1
       end
     end
-    
-    -- Start watching
-    local success, err = pcall(function()
-      uv.fs_event_start(handle_event, dir, flags, callback)
-    end)
-    
-    if not success then
-      vim.notify("Failed to start watching " .. dir .. ": " .. tostring(err), vim.log.levels.WARN)
-      goto continue
+
+    if #to_register > 0 then
+      schedule_slice()
+    elseif scan_done then
+      report()
     end
-    
-    events.watching[directory][dir] = handle_event
-    watch_count = watch_count + 1
-    
-    ::continue::
   end
-  
-  vim.notify(
-    string.format("Watching %d director%s in: %s%s",
-      watch_count,
-      watch_count == 1 and "y" or "ies",
-      directory,
-      excluded_count > 0 and string.format(" (%d excluded)", excluded_count) or ""
-    ),
-    vim.log.levels.INFO
+
+  scan_directories(
+    directory,
+    function(dir)
+      return cancelled() or is_excluded_directory(dir, excluded_directories) or is_excluded_by_pattern(dir)
+    end,
+    function(dir)
+      table.insert(to_register, dir)
+      schedule_slice()
+    end,
+    function(skipped)
+      scan_done = true
+      excluded_count = skipped
+      schedule_slice()
+    end
   )
-  
-  return watch_count > 0
+
+  return true
 end
 
 ---Check if a directory is being watched
@@ -1,7 +1,20 @@
 -- Transmit: SFTP file transfer plugin for Neovim
-local sftp = require("transmit.sftp2")
-local events = require("transmit.events")
-local util = require("transmit.util")
+
+---Defer loading a module until one of its fields is first accessed
+---@param name string Module name
+---@return table proxy Table forwarding every lookup to the loaded module
+local function lazy_require(name)
+  return setmetatable({}, {
+    __index = function(_, key)
+      return require(name)[key]
+    end,
+  })
+end
+
+-- Loaded on first use so setup stays cheap during startup
+local sftp = lazy_require("transmit.sftp2")
+local events = lazy_require("transmit.events")
+local util = lazy_require("transmit.util")
 
 -- Constants
 local CLOSING_KEYS = {'<Esc>'}
@@ -9,6 +22,8 @@ local WINDOW_CONFIG = {
   width = 40,
   height = 10,
 }
+-- Milliseconds after VimEnter before watching starts and the helper is spawned
+local STARTUP_DELAY = 100
 
 ---@class TransmitConfig
 ---@field config_location string Path to the SFTP configuration file
@@ -16,6 +31,58 @@ local WINDOW_CONFIG = {
 ---@class Transmit
 local transmit = {}
 
+-- Deferred initialization state
+local init = {
+  config_location = nil, ---@type string|nil
+  done = false,
+  ok = false,
+}
+
+---Parse the SFTP configuration the first time it is needed
+---@return boolean success Returns true if the configuration is loaded
+local function ensure_initialized()
+  if init.done then
+    return init.ok
+  end
+  if not init.config_location then
+    return false
+  end
+
+  init.done = true
+  init.ok = sftp.parse_sftp_config(init.config_location)
+  if not init.ok then
+    vim.notify("Transmit: Failed to parse SFTP configuration", vim.log.levels.ERROR)
+  end
+  return init.ok
+end
+
+---Start background work for the working directory once the UI is up
+---@return nil
+local function start_deferred()
+  if not ensure_initialized() then
+    return
+  end
+
+  local server_config = sftp.get_sftp_server_config()
+  if not server_config then
+    return
+  end
+
+  -- Anything a crashed session left unsent goes out first
+  sftp.resume_queue()
+
+  -- Spawn the helper speculatively; prewarming also caches the remote root
+  if not sftp.prewarm(vim.loop.cwd()) then
+    sftp.ensure_connection()
+  end
+
+  if server_config.watch_for_changes then
+    transmit.watch_current_working_directory()
+  end
+
+  transmit.prewarm_buffer(vim.api.nvim_get_current_buf())
+end
+
 ---Get centered window position
 ---@param width number Window width
 ---@param height number Window height
@@ -119,6 +186,7 @@ end
 ---Open server selection window
 ---@return nil
 function transmit.open_select_window()
+  ensure_initialized()
   local servers = get_server_list()
   
   -- Check if any servers are configured beyond 'none'
@@ -140,6 +208,8 @@ function transmit.open_select_window()
 end
 
 ---Setup the Transmit plugin
+---Only commands and autocmds are registered here; the configuration is parsed
+---on first use and watching starts shortly after VimEnter.
 ---@param config TransmitConfig Configuration table
 ---@return boolean success Returns true if setup was successful
 function transmit.setup(config)
@@ -148,12 +218,9 @@ function transmit.setup(config)
     return false
   end
 
-  -- Parse SFTP configuration FIRST
-  local success = sftp.parse_sftp_config(config.config_location)
-  if not success then
-    vim.notify("Transmit: Failed to parse SFTP configuration", vim.log.levels.ERROR)
-    return false
-  end
+  init.config_location = config.config_location
+  init.done = false
+  init.ok = false
 
   -- Register commands
   vim.api.nvim_create_user_command('TransmitOpenSelectWindow', function()
@@ -168,29 +235,82 @@ function transmit.setup(config)
     transmit.remove_path()
   end, { desc = "Remove current file from remote via SFTP" })
 
-  -- NOW check if a server is selected for current directory (optional)
-  local server_config = sftp.get_sftp_server_config()
+  vim.api.nvim_create_user_command('TransmitCopy', function(opts)
+    transmit.copy(opts.fargs[1], opts.fargs[2])
+  end, { nargs = 2, desc = "Copy server:path to server:path without going through this machine" })
+
+  vim.api.nvim_create_user_command('TransmitRelease', function(opts)
+    transmit.release(opts.fargs[1])
+  end, {
+    nargs = 1,
+    complete = function() return { "begin", "commit", "abort" } end,
+    desc = "Stage uploads into a new remote release, then switch to it atomically",
+  })
+
+  -- Auto-upload on buffer write; the server's setting is checked per write
+  vim.api.nvim_create_augroup("TransmitAutoCommands", { clear = true })
+  vim.api.nvim_create_autocmd("BufWritePost", {
+    group = "TransmitAutoCommands",
+    callback = function()
+      if not ensure_initialized() then
+        return
+      end
+      local server_config = sftp.get_sftp_server_config()
+      if server_config and server_config.upload_on_bufwrite then
+        transmit.upload_file()
+      end
+    end,
+    desc = "Auto-upload file after save"
+  })
+
+  -- Registered regardless of selection so a server picked later is covered
+  vim.api.nvim_create_augroup("TransmitPrewarm", { clear = true })
+  vim.api.nvim_create_autocmd("BufEnter", {
+    group = "TransmitPrewarm",
+    callback = function(args)
+      transmit.prewarm_buffer(args.buf)
+    end,
+    desc = "Prewarm remote directory of entered buffer"
+  })
+
+  -- Keep the project scan and helper spawn out of startup
+  if vim.v.vim_did_enter == 1 then
+    vim.defer_fn(start_deferred, STARTUP_DELAY)
+  else
+    vim.api.nvim_create_autocmd("VimEnter", {
+      group = "TransmitAutoCommands",
+      once = true,
+      callback = function()
+        vim.defer_fn(start_deferred, STARTUP_DELAY)
+      end,
+      desc = "Start Transmit background work after startup"
+    })
+  end
 
-  if server_config then
-    -- Setup auto-upload on buffer write if configured
-    if server_config.upload_on_bufwrite then
-      vim.api.nvim_create_augroup("TransmitAutoCommands", { clear = true })
-      vim.api.nvim_create_autocmd("BufWritePost", {
-        group = "TransmitAutoCommands",
-        callback = function()
-          transmit.upload_file()
-        end,
-        desc = "Auto-upload file after save"
-      })
-    end
+  return true
+end
 
-    -- Setup directory watching if configured
-    if server_config.watch_for_changes then
-      -- Watch functionality enabled
-    end
+---Prewarm the remote directory of a buffer under the working directory
+---@param buf number|nil Buffer handle (defaults to the current buffer)
+---@return boolean success Returns true if a prewarm hint was queued
+function transmit.prewarm_buffer(buf)
+  -- Buffers entered during startup are covered by the deferred start
+  if not init.ok then
+    return false
   end
 
-  return true
+  local file = vim.api.nvim_buf_get_name(buf or 0)
+  local cwd = vim.loop.cwd()
+
+  if file == "" or vim.bo[buf or 0].buftype ~= "" or not vim.startswith(file, cwd .. "/") then
+    return false
+  end
+
+  if not sftp.working_dir_has_active_sftp_selection(cwd) then
+    return false
+  end
+
+  return sftp.prewarm(cwd, file)
 end
 
 ---Get the current server name for the current working directory
@@ -300,6 +420,8 @@ function transmit.select_remote(server_name)
   vim.notify("Selected: " .. server_name .. " -> " .. selected_remote, vim.log.levels.INFO)
 
   local server_config = sftp.get_sftp_server_config()
+
+  sftp.prewarm(vim.loop.cwd())
   
   -- Start watching if configured
   if server_config and server_config.watch_for_changes then
@@ -313,6 +435,10 @@ end
 ---@param directory string The directory path to watch
 ---@return boolean success Returns true if watching started
 function transmit.watch_directory(directory)
+  if not ensure_initialized() then
+    return false
+  end
+
   local server_name = transmit.get_server(directory)
   
   if not sftp.server_config[server_name] or server_name == 'none' then
@@ -334,6 +460,10 @@ end
 ---Watch the current working directory for changes
 ---@return boolean success Returns true if watching started
 function transmit.watch_current_working_directory()
+  if not ensure_initialized() then
+    return false
+  end
+
   local server_name = transmit.get_current_server()
   
   if not sftp.server_config[server_name] or server_name == 'none' then
@@ -356,6 +486,9 @@ end
 ---@param path string|nil Optional path to remove (defaults to current file)
 ---@return boolean success Returns true if removal was queued
 function transmit.remove_path(path)
+  if not ensure_initialized() then
+    return false
+  end
   return util.remove_path(path)
 end
 
@@ -363,9 +496,34 @@ end
 ---@param file string|nil Optional file path (defaults to current file)
 ---@return boolean success Returns true if upload was queued
 function transmit.upload_file(file)
+  if not ensure_initialized() then
+    return false
+  end
   return util.upload_file(file)
 end
 
+---Copy a file or tree from one configured server to another
+---@param source string `server:path` to copy from
+---@param target string `server:path` to copy to
+---@return number|nil queue_id Returns queue item ID on success, nil on failure
+function transmit.copy(source, target)
+  if not ensure_initialized() then
+    return nil
+  end
+  return sftp.add_copy(source, target)
+end
+
+---Step through an atomic release of the current project. Its remote must be
+---a symlink such as /srv/app/current; releases are kept beside it in releases/.
+---@param action "begin"|"commit"|"abort" Release step
+---@return number|nil queue_id Returns queue item ID on success, nil on failure
+function transmit.release(action)
+  if not ensure_initialized() then
+    return nil
+  end
+  return sftp.add_release(action, vim.loop.cwd())
+end
+
 ---Remove directory watchers
 ---@param directory string|nil Optional directory path (nil removes all watchers)
 ---@return nil
@@ -383,6 +541,18 @@ function transmit.get_progress()
   return sftp.get_progress()
 end
 
+---Get the status summary also published with `User TransmitProgress`
+---@return TransmitStatus status Shared table; treat it as read-only
+function transmit.get_status()
+  return sftp.get_status()
+end
+
+---Get the last run of each server hook, keyed by remote root
+---@return table<string, HookRun> runs Exit status, duration and output per root
+function transmit.get_hook_runs()
+  return sftp.get_hook_runs()
+end
+
 ---Get the number of items in the upload queue
 ---@return number count Number of items in queue
 function transmit.queue_length()
@@ -395,6 +565,12 @@ function transmit.get_queue()
   return sftp.get_queue()
 end
 
+---Iterate over queue items without copying the queue
+---@return fun(): QueueItem|nil iterator Yields live items, oldest first
+function transmit.iter_queue()
+  return sftp.iter_queue()
+end
+
 ---Cancel a queued operation by ID
 ---@param queue_id number The queue item ID to cancel
 ---@return boolean success Returns true if item was cancelled
@@ -0,0 +1,217 @@
+-- Buffered asynchronous log writer
+local uv = vim.loop
+
+---@class Logger
+local logger = {}
+
+-- Defaults
+local DEFAULTS = {
+  max_size = 50 * 1024 * 1024, -- Rotate once the active file exceeds this
+  segments = 3, -- Rotated files kept next to the active one (path.1 .. path.N)
+  flush_interval = 1000, -- Milliseconds before buffered lines are written
+  flush_bytes = 64 * 1024, -- Buffered bytes that trigger an immediate flush
+  capacity = 8192, -- Buffered lines kept; the oldest are dropped beyond this
+}
+
+---@class LogWriter
+---@field path string
+---@field opts table
+---@field ring string[]
+---@field head number Index of the oldest buffered line
+---@field count number Buffered lines
+---@field bytes number Buffered bytes
+---@field dropped number Lines dropped because the ring was full
+---@field fd number|nil Open descriptor of the active file
+---@field size number|nil Size of the active file
+---@field busy boolean A flush or rotation is in flight
+---@field pending boolean Another flush was requested while busy
+---@field timer uv_timer_t|nil
+local Writer = {}
+Writer.__index = Writer
+
+---Create a log writer for a file
+---@param path string File to append to
+---@param opts table|nil Overrides for DEFAULTS
+---@return LogWriter writer
+function logger.new(path, opts)
+  local writer = setmetatable({
+    path = path,
+    opts = vim.tbl_extend("force", DEFAULTS, opts or {}),
+    ring = {},
+    head = 1,
+    count = 0,
+    bytes = 0,
+    dropped = 0,
+    fd = nil,
+    size = nil,
+    busy = false,
+    pending = false,
+    timer = nil,
+  }, Writer)
+  return writer
+end
+
+---Append a line to the buffer; never touches the file on the caller's stack
+---@param line string Line without trailing newline
+---@return nil
+function Writer:write(line)
+  local capacity = self.opts.capacity
+  if self.count == capacity then
+    -- Ring full: overwrite the oldest line rather than grow without bound
+    local oldest = self.ring[self.head]
+    self.bytes = self.bytes - #oldest
+    self.head = self.head % capacity + 1
+    self.count = self.count - 1
+    self.dropped = self.dropped + 1
+  end
+
+  local slot = (self.head + self.count - 1) % capacity + 1
+  self.ring[slot] = line .. "\n"
+  self.count = self.count + 1
+  self.bytes = self.bytes + #self.ring[slot]
+
+  if self.bytes >= self.opts.flush_bytes then
+    self:flush()
+  elseif not self.timer then
+    self.timer = uv.new_timer()
+    self.timer:start(self.opts.flush_interval, 0, function()
+      self.timer:close()
+      self.timer = nil
+      self:flush()
+    end)
+  end
+end
+
+---Take the buffered lines as a single string and empty the ring
+---@return string|nil data
+function Writer:drain()
+  if self.count == 0 then
+    return nil
+  end
+
+  local capacity = self.opts.capacity
+  local parts = {}
+  if self.dropped > 0 then
+    parts[1] = string.format("[transmit] %d log lines dropped while the writer was behind\n", self.dropped)
+    self.dropped = 0
+  end
+  for i = 0, self.count - 1 do
+    local slot = (self.head + i - 1) % capacity + 1
+    parts[#parts + 1] = self.ring[slot]
+    self.ring[slot] = nil
+  end
+
+  self.head = 1
+  self.count = 0
+  self.bytes = 0
+  return table.concat(parts)
+end
+
+---Finish a flush and start another if lines arrived meanwhile
+---@return nil
+function Writer:done()
+  self.busy = false
+  if self.pending then
+    self.pending = false
+    self:flush()
+  end
+end
+
+---Shift path -> path.1 -> ... -> path.N, dropping the oldest segment
+---@param callback function Called when the rename chain has finished
+---@return nil
+function Writer:rotate(callback)
+  local segments = self.opts.segments
+
+  local function shift(n)
+    if n < 1 then
+      uv.fs_rename(self.path, self.path .. ".1", function()
+        callback()
+      end)
+      return
+    end
+    uv.fs_rename(self.path .. "." .. n, self.path .. "." .. (n + 1), function()
+      shift(n - 1)
+    end)
+  end
+
+  uv.fs_unlink(self.path .. "." .. segments, function()
+    shift(segments - 1)
+  end)
+end
+
+---Write buffered lines asynchronously on the libuv threadpool
+---@return nil
+function Writer:flush()
+  if self.busy then
+    self.pending = true
+    return
+  end
+
+  local data = self:drain()
+  if not data then
+    return
+  end
+  self.busy = true
+
+  local function write(fd)
+    uv.fs_write(fd, data, -1, function(err)
+      if not err then
+        self.size = (self.size or 0) + #data
+      end
+
+      if self.size and self.size > self.opts.max_size then
+        uv.fs_close(fd, function()
+          self.fd = nil
+          self.size = nil
+          self:rotate(function()
+            self:done()
+          end)
+        end)
+      else
+        self:done()
+      end
+    end)
+  end
+
+  if self.fd then
+    write(self.fd)
+    return
+  end
+
+  uv.fs_open(self.path, "a", 420, function(err, fd)
+    if err or not fd then
+      self:done()
+      return
+    end
+    self.fd = fd
+    uv.fs_fstat(fd, function(_, stat)
+      self.size = stat and stat.size or 0
+      write(fd)
+    end)
+  end)
+end
+
+---Write everything buffered synchronously, e.g. while Neovim exits
+---@return nil
+function Writer:flush_sync()
+  if self.timer then
+    self.timer:stop()
+    self.timer:close()
+    self.timer = nil
+  end
+
+  local data = self:drain()
+  if not data then
+    return
+  end
+
+  -- Use a descriptor of our own; an async write may still hold self.fd
+  local fd = uv.fs_open(self.path, "a", 420)
+  if fd then
+    uv.fs_write(fd, data, -1)
+    uv.fs_close(fd)
+  end
+end
+
+return logger
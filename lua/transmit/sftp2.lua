@@ -1,6 +1,7 @@
 -- SFTP module with connection management and file transfer queue
 local data_path = vim.fn.stdpath("data")
 local Path = require("plenary.path")
+local logger = require("transmit.logger")
 local uv = vim.loop
 
 -- Constants for phase names
@@ -17,6 +18,8 @@ local PHASE = {
 local OPERATION_TYPE = {
   UPLOAD = "upload",
   REMOVE = "remove",
+  COPY = "copy",
+  RELEASE = "release",
 }
 
 local LOG_LEVELS = {
@@ -28,24 +31,71 @@ local LOG_LEVELS = {
 
 -- Configuration
 local config = {
-  keepalive_timeout = 5 * 60 * 1000, -- 5 minutes
+  idle_timeout = 60 * 60, -- Seconds idle before the helper drops the SSH session (0 = never)
+  ssh_keepalive_interval = 30, -- Seconds between helper keepalives while idle
+  reconnect_on_focus = true, -- Let the helper re-establish a dropped session on FocusGained
+  prewarm = true, -- Connect and cache remote directories when a project or buffer is opened
+  journal = true, -- Let the helper journal operations so a crash mid-sync resumes where it stopped
+  save_latency = 2, -- Seconds a save may wait behind a sync before the helper opens a connection for it (0 = no bound)
+  hook_quiet_period = 2, -- Seconds without transfers under a remote before its hook runs (servers may override)
   auth_timeout = 30 * 1000, -- 30 seconds
-  log_rotation_size = 50 * 1024 * 1024, -- 50MB
-  log_check_interval = 100, -- Check log size every 100 writes
+  log_rotation_size = 50 * 1024 * 1024, -- 50MB per log segment before rotating
   log_level = LOG_LEVELS.INFO, -- Default log level
+  status_interval = 100, -- Minimum milliseconds between TransmitProgress events
 }
 
 ---@class QueueItem
----@field type "upload"|"remove"
----@field filename string
+---@field type "upload"|"remove"|"copy"|"release"
+---@field filename string Local file, the `server:path` source of a copy, or a release's project root
+---@field target string|nil `server:path` destination of a copy
+---@field action "begin"|"commit"|"abort"|nil Step of a release
 ---@field working_dir string
 ---@field processing boolean
 ---@field id number
+---@field cancelled boolean|nil
+---@field bulk boolean|nil Part of a sync or watcher burst rather than a save
+---@field barrier QueueItem|nil Release step a save must not be sent ahead of
+---@field remote_path string|nil Target the item was last sent to the helper with
+---@field list QueueList|nil List holding the item
+---@field prev QueueItem|nil
+---@field next QueueItem|nil
+
+---Doubly linked list of queue items. Items know their list, so moving or
+---cancelling one never scans or shifts anything.
+---@class QueueList
+---@field first QueueItem|nil
+---@field last QueueItem|nil
+
+---@class Queue
+---@field sent QueueList Items with the helper, in the order it reports them
+---@field resend QueueList Items a lost helper never reported, sent first
+---@field saves QueueList Unsent saves, sent ahead of bulk items
+---@field bulk QueueList Unsent sync, watcher, copy and release items
+---@field by_id table<number, QueueItem> Live items by ID
+---@field size number Live items
 
 ---@class ProgressInfo
 ---@field file string|nil
 ---@field percent number|nil
 
+---Summary published with the `User TransmitProgress` autocmd
+---@class TransmitStatus
+---@field file string|nil File currently transferring
+---@field percent number|nil Progress of that file
+---@field queued number Live queue items, including in-flight ones
+---@field in_flight number Items sent to the helper
+---@field connected boolean
+---@field connecting boolean
+---@field last_hook HookRun|nil Most recent hook run
+---@field text string Short preformatted summary for statuslines
+
+---@class HookRun
+---@field root string Remote root the hook is registered for
+---@field status number Exit status, -1 if it couldn't run or timed out
+---@field duration_ms number
+---@field output string Start of its output, on one line
+---@field finished_at number os.time() when the helper reported it
+
 ---@class ServerCredentials
 ---@field host string
 ---@field username string
@@ -54,39 +104,79 @@ local config = {
 ---@class ServerConfig
 ---@field credentials ServerCredentials
 ---@field remotes table<string, string>
+---@field standby boolean|nil Keep a warm spare session for instant failover
+---@field hooks table<string, string|string[]>|nil Commands run on the server, keyed by remote name, once transfers under that remote settle
+---@field hook_quiet_period number|nil Seconds without transfers before a hook runs
 
 ---@class TransmitData
 ---@field [string] {server_name: string, remote: string}
 
 ---@class SFTPState
 ---@field server_config table<string, ServerConfig>
----@field queue QueueItem[]
+---@field queue Queue
 ---@field transmit_job number|nil
 ---@field transmit_phase string
----@field keepalive_timer uv_timer_t|nil
 ---@field auth_timeout_timer uv_timer_t|nil
 ---@field connecting boolean
 ---@field connection_ready boolean
 ---@field is_exiting boolean
----@field log_check_counter number
 ---@field current_progress ProgressInfo
 ---@field next_queue_id number
+---@field helper_protocol number
+---@field prewarmed table<string, boolean>
+---@field prewarm_pending table<string, boolean>
+---@field defined table<string, boolean> Servers the running helper knows as copy endpoints
+---@field hook_runs table<string, HookRun> Last run per remote root
+---@field last_hook HookRun|nil
+---@field credits number
+---@field credit_based boolean
+---@field in_flight number
+---@field stdout_partial string
+---@field replay_settled boolean
+---@field replayed table<string, boolean>
+---@field queue_save_scheduled boolean
+---@field release_item QueueItem|nil
+---@field pending_by_file table<string, QueueItem>
+---@field status TransmitStatus|nil Last published status
+---@field status_scheduled boolean
+---@field status_published_at number
 local state = {
   server_config = {},
-  queue = {},
+  queue = { sent = {}, resend = {}, saves = {}, bulk = {}, by_id = {}, size = 0 },
   transmit_job = nil,
   transmit_phase = PHASE.INIT,
-  keepalive_timer = nil,
   auth_timeout_timer = nil,
   connecting = false,
   connection_ready = false,
   is_exiting = false,
-  log_check_counter = 0,
   current_progress = {
     file = nil,
     percent = nil,
   },
   next_queue_id = 1,
+  helper_protocol = 0,
+  prewarmed = {},
+  prewarm_pending = {},
+  defined = {},
+  hook_runs = {},
+  last_hook = nil,
+  -- Flow control: commands are only sent within the helper's credit grant,
+  -- so a massive sync waits here as a deduplicated list instead of flooding
+  -- the helper's stdin
+  credits = 0,
+  credit_based = false,
+  in_flight = 0,
+  stdout_partial = "", -- Helper output after its last newline
+  -- A new helper first replays its journal; resends wait until it reports
+  -- what it finished, keyed "op|remote_path", so nothing is uploaded twice
+  replay_settled = true,
+  replayed = {},
+  queue_save_scheduled = false,
+  release_item = nil, -- Newest release step; saves queued after it never overtake it
+  pending_by_file = {},
+  status = nil,
+  status_scheduled = false,
+  status_published_at = 0,
 }
 
 ---@class SFTP
@@ -97,6 +187,37 @@ sftp.server_config = state.server_config
 
 local transmit_server_data = string.format("%s/transmit.json", data_path)
 
+-- Unsent items are kept on disk per project, so a sync interrupted by an
+-- editor crash resumes on the next start. Writes are coalesced to one per
+-- interval.
+local queue_file = string.format("%s/transmit-queue-%s.json", data_path, vim.fn.sha256(vim.loop.cwd()):sub(1, 16))
+local QUEUE_SAVE_MS = 1000
+
+-- transmit.json is re-read only when its mtime or size changes, and stat'ed
+-- at most once per revalidation interval, so dispatch and statusline reads
+-- do no file I/O in the common case
+local DATA_REVALIDATE_MS = 1000
+local data_cache = {
+  data = nil,
+  mtime_sec = nil,
+  mtime_nsec = nil,
+  size = nil,
+  checked_at = nil,
+  remote_bases = {}, -- working_dir -> { config = ServerConfig, base = string }
+}
+
+---Drop the cached transmit.json contents
+---@return nil
+local function invalidate_transmit_data()
+  data_cache.data = nil
+  data_cache.checked_at = nil
+  data_cache.remote_bases = {}
+end
+
+-- Both logs are buffered in memory and written off the hot path
+local debug_log = logger.new(vim.fn.stdpath("cache") .. "/sftp_debug.txt", { max_size = config.log_rotation_size })
+local helper_log = logger.new(vim.fn.stdpath("cache") .. "/sftp_log.txt", { max_size = config.log_rotation_size })
+
 ---Log message with level filtering
 ---@param level number Log level
 ---@param message string Message to log
@@ -106,15 +227,9 @@ local function log(level, message, notify)
     return
   end
   
-  local log_file_path = vim.fn.stdpath("cache") .. "/sftp_debug.txt"
-  local log_file = io.open(log_file_path, "a")
-  
-  if log_file then
-    local level_names = {"DEBUG", "INFO", "WARN", "ERROR"}
-    local timestamp = os.date("[%Y-%m-%d %H:%M:%S]")
-    log_file:write(string.format("%s [%s] %s\n", timestamp, level_names[level] or "UNKNOWN", message))
-    log_file:close()
-  end
+  local level_names = {"DEBUG", "INFO", "WARN", "ERROR"}
+  local timestamp = os.date("[%Y-%m-%d %H:%M:%S]")
+  debug_log:write(string.format("%s [%s] %s", timestamp, level_names[level] or "UNKNOWN", message))
   
   if notify then
     local vim_levels = {
@@ -127,14 +242,65 @@ local function log(level, message, notify)
   end
 end
 
----Cleanup all timers and state
-local function cleanup_state()
-  if state.keepalive_timer then
-    state.keepalive_timer:stop()
-    state.keepalive_timer:close()
-    state.keepalive_timer = nil
+---Write the items no running helper holds to the queue file. Those sent to
+---the helper are left out: it finishes them even when the editor goes away,
+---and its journal covers the ones it can't.
+---@return nil
+local function save_queue()
+  state.queue_save_scheduled = false
+  local queue = state.queue
+  local entries = {}
+  for _, list in ipairs({ queue.resend, queue.saves, queue.bulk }) do
+    local item = list.first
+    while item do
+      table.insert(entries, {
+        id = item.id,
+        type = item.type,
+        filename = item.filename,
+        target = item.target,
+        action = item.action,
+        working_dir = item.working_dir,
+        bulk = item.bulk,
+        remote_path = item.remote_path,
+      })
+      item = item.next
+    end
+  end
+
+  if #entries == 0 then
+    os.remove(queue_file)
+    return
+  end
+  -- Restored in the order they were queued, so saves find their barriers
+  table.sort(entries, function(a, b) return a.id < b.id end)
+  local tmp = queue_file .. ".tmp"
+  local ok, err = pcall(function()
+    Path:new(tmp):write(vim.json.encode(entries), "w")
+  end)
+  if ok then
+    ok, err = os.rename(tmp, queue_file)
   end
+  if not ok then
+    log(LOG_LEVELS.WARN, "Failed to save the queue: " .. tostring(err))
+  end
+end
+
+---Note a queue change; the queue file is rewritten once per QUEUE_SAVE_MS
+---@return nil
+local function queue_changed()
+  if state.queue_save_scheduled or state.is_exiting then
+    return
+  end
+  state.queue_save_scheduled = true
+  vim.defer_fn(function()
+    if not state.is_exiting then
+      save_queue()
+    end
+  end, QUEUE_SAVE_MS)
+end
 
+---Cleanup all timers and state
+local function cleanup_state()
   if state.auth_timeout_timer then
     state.auth_timeout_timer:stop()
     state.auth_timeout_timer:close()
@@ -156,8 +322,24 @@ end
 vim.api.nvim_create_autocmd("VimLeavePre", {
   callback = function()
     state.is_exiting = true
+    save_queue()
     cleanup_state()
-    state.queue = {}
+    debug_log:flush_sync()
+    helper_log:flush_sync()
+    state.queue = { sent = {}, resend = {}, saves = {}, bulk = {}, by_id = {}, size = 0 }
+    state.release_item = nil
+    state.pending_by_file = {}
+  end
+})
+
+-- Returning to the editor is a good moment to replace a session that went
+-- stale meanwhile, before the next save has to wait for it
+vim.api.nvim_create_autocmd("FocusGained", {
+  callback = function()
+    if config.reconnect_on_focus and state.transmit_job and state.connection_ready
+      and state.helper_protocol >= 2 then
+      vim.fn.chansend(state.transmit_job, "focus\n")
+    end
   end
 })
 
@@ -217,28 +399,297 @@ local function get_transmit_path()
   return transmit_path
 end
 
----Get the first item in the queue (O(1))
----@return QueueItem|nil item The current queue item or nil if queue is empty
+---Build the status summary from the current state
+---@return TransmitStatus status
+local function build_status()
+  local progress = state.current_progress
+  local queued = state.queue.size
+  local text = ""
+  if progress.file then
+    text = string.format("%s %d%%", vim.fn.fnamemodify(progress.file, ":t"), progress.percent or 0)
+    if queued > 1 then
+      text = text .. string.format(" (+%d)", queued - 1)
+    end
+  elseif queued > 0 then
+    text = string.format("%d queued", queued)
+  elseif state.connecting then
+    text = "connecting"
+  end
+
+  return {
+    file = progress.file,
+    percent = progress.percent,
+    queued = queued,
+    in_flight = state.in_flight,
+    connected = state.connection_ready,
+    connecting = state.connecting,
+    last_hook = state.last_hook,
+    text = text,
+  }
+end
+
+---Fire `User TransmitProgress` if the summary differs from the last one
+---@return nil
+local function publish_status()
+  state.status_scheduled = false
+  state.status_published_at = uv.now()
+
+  local status = build_status()
+  if state.status and vim.deep_equal(status, state.status) then
+    return
+  end
+  state.status = status
+
+  vim.api.nvim_exec_autocmds("User", {
+    pattern = "TransmitProgress",
+    modeline = false,
+    data = status,
+  })
+end
+
+---Note a state change; events are coalesced to one per status_interval
+---@return nil
+local function status_changed()
+  if state.status_scheduled or state.is_exiting then
+    return
+  end
+  state.status_scheduled = true
+
+  local wait = config.status_interval - (uv.now() - state.status_published_at)
+  vim.defer_fn(publish_status, math.max(wait, 0))
+end
+
+---Append an item to a list (O(1))
+---@param list QueueList
+---@param item QueueItem
+---@return nil
+local function list_push(list, item)
+  item.list, item.prev, item.next = list, list.last, nil
+  if list.last then
+    list.last.next = item
+  else
+    list.first = item
+  end
+  list.last = item
+end
+
+---Prepend an item to a list (O(1))
+---@param list QueueList
+---@param item QueueItem
+---@return nil
+local function list_push_front(list, item)
+  item.list, item.prev, item.next = list, nil, list.first
+  if list.first then
+    list.first.prev = item
+  else
+    list.last = item
+  end
+  list.first = item
+end
+
+---Take an item out of whichever list holds it (O(1))
+---@param item QueueItem
+---@return nil
+local function list_unlink(item)
+  local list = item.list
+  if item.prev then
+    item.prev.next = item.next
+  else
+    list.first = item.next
+  end
+  if item.next then
+    item.next.prev = item.prev
+  else
+    list.last = item.prev
+  end
+  item.list, item.prev, item.next = nil, nil, nil
+end
+
+---The newest release step while it is still waiting to be sent
+---@return QueueItem|nil release
+local function unsent_release()
+  local release = state.release_item
+  if release and release.list and release.list ~= state.queue.sent then
+    return release
+  end
+  return nil
+end
+
+---Queue an item behind the others of its kind (O(1)). Saves go ahead of
+---bulk items, so a large sync can't delay them, but never ahead of a release
+---step queued before them.
+---@param item QueueItem The item to append
+---@return nil
+local function push_queue_item(item)
+  local queue = state.queue
+  if item.bulk then
+    list_push(queue.bulk, item)
+  else
+    item.barrier = unsent_release()
+    list_push(queue.saves, item)
+  end
+  queue.by_id[item.id] = item
+  queue.size = queue.size + 1
+  queue_changed()
+  status_changed()
+end
+
+---Turn an unsent bulk item into a save, queued behind the other saves (O(1))
+---@param item QueueItem The unsent bulk item
+---@return nil
+local function promote_to_save(item)
+  list_unlink(item)
+  item.bulk = nil
+  item.barrier = unsent_release()
+  list_push(state.queue.saves, item)
+  queue_changed()
+  status_changed()
+end
+
+---Get the oldest item with the helper, the one its next result is for (O(1))
+---@return QueueItem|nil item The current queue item or nil if none was sent
 local function get_current_queue_item()
-  return state.queue[1]
+  return state.queue.sent.first
 end
 
----Remove the first item from the queue (O(n))
+---Remove the oldest item with the helper (O(1))
 ---@return nil
 local function remove_item_from_queue()
-  table.remove(state.queue, 1)
+  local item = get_current_queue_item()
+  if item then
+    list_unlink(item)
+    state.queue.by_id[item.id] = nil
+    state.queue.size = state.queue.size - 1
+    status_changed()
+  end
 end
 
----Find a queue item by ID
+---Find a queue item by ID (O(1))
 ---@param id number Queue item ID
----@return QueueItem|nil, number|nil item, index The queue item and its index, or nil
+---@return QueueItem|nil item The queue item, or nil
 local function find_queue_item(id)
-  for i, item in ipairs(state.queue) do
-    if item.id == id then
-      return item, i
+  return state.queue.by_id[id]
+end
+
+---Forget an unsent item in the per-file dedup index
+---@param item QueueItem The item leaving the pending list
+---@return nil
+local function unindex_pending(item)
+  if state.pending_by_file[item.filename] == item then
+    state.pending_by_file[item.filename] = nil
+  end
+end
+
+---Cancel an unsent item (O(1))
+---@param item QueueItem The item to cancel
+---@return nil
+local function cancel_item(item)
+  item.cancelled = true
+  list_unlink(item)
+  state.queue.by_id[item.id] = nil
+  state.queue.size = state.queue.size - 1
+  unindex_pending(item)
+  queue_changed()
+  status_changed()
+end
+
+---Iterate over live queue items without copying: those with the helper
+---first, then the unsent ones in the order they would be sent. The yielded
+---item may be cancelled before the next call.
+---@return fun(): QueueItem|nil iterator
+local function iter_queue()
+  local queue = state.queue
+  local lists = { queue.sent, queue.resend, queue.saves, queue.bulk }
+  local index, upcoming = 0, nil
+  return function()
+    while not upcoming do
+      index = index + 1
+      if index > #lists then
+        return nil
+      end
+      upcoming = lists[index].first
+    end
+    local item = upcoming
+    upcoming = item.next
+    return item
+  end
+end
+
+---Get the next item to send: anything a lost helper never reported, then
+---saves, then bulk items. A save queued behind a release step waits until
+---the step is sent.
+---@return QueueItem|nil item
+local function next_unsent_item()
+  local queue = state.queue
+  if queue.resend.first then
+    return queue.resend.first
+  end
+  local save = queue.saves.first
+  if save and not (save.barrier and save.barrier.list and save.barrier.list ~= queue.sent) then
+    return save
+  end
+  return queue.bulk.first or save
+end
+
+---Record that an item went to the helper, whose results come back in order
+---@param item QueueItem
+---@return nil
+local function mark_sent(item)
+  item.processing = true
+  list_unlink(item)
+  list_push(state.queue.sent, item)
+  queue_changed()
+end
+
+---Mark every in-flight item unsent again, e.g. after losing the helper.
+---They are sent again first, in their original order.
+---@return nil
+local function requeue_in_flight()
+  local queue = state.queue
+  local item = queue.sent.last
+  while item do
+    local previous = item.prev
+    item.processing = false
+    list_unlink(item)
+    list_push_front(queue.resend, item)
+    if not state.pending_by_file[item.filename] then
+      state.pending_by_file[item.filename] = item
+    end
+    item = previous
+  end
+  state.in_flight = 0
+  queue_changed()
+  status_changed()
+end
+
+---Drop the items waiting to be resent that the helper's journal replay
+---already finished or skipped, then let sending start
+---@return nil
+local function settle_replayed()
+  local item = state.queue.resend.first
+  while item do
+    local following = item.next
+    if item.remote_path and state.replayed[item.type .. "|" .. item.remote_path] then
+      log(LOG_LEVELS.DEBUG, "Already replayed by the helper [" .. item.id .. "]: " .. item.filename)
+      cancel_item(item)
     end
+    item = following
+  end
+  state.replayed = {}
+  state.replay_settled = true
+end
+
+---Whether another command may be sent to the helper now
+---@return boolean allowed
+local function has_send_budget()
+  if state.helper_protocol >= 10 and not state.replay_settled then
+    return false
+  end
+  if state.credit_based then
+    return state.credits > 0
   end
-  return nil, nil
+  -- Helpers without flow control get one command at a time
+  return state.in_flight == 0
 end
 
 ---Escape special pattern characters in a string
@@ -248,25 +699,45 @@ local function escapePattern(str)
   return (str:gsub("([%%%.%+%-%*%?%[%]%^%$%(%)])", "%%%1"))
 end
 
----Read transmit data from JSON file
+---Read transmit data from JSON file (cached, see DATA_REVALIDATE_MS)
 ---@return TransmitData|nil data The transmit configuration data or nil on error
 local function get_transmit_data()
-  local path = Path:new(transmit_server_data)
-  if not path:exists() then 
+  local now = uv.now()
+  if data_cache.data and data_cache.checked_at and now - data_cache.checked_at < DATA_REVALIDATE_MS then
+    return data_cache.data
+  end
+  data_cache.checked_at = now
+
+  local stat = uv.fs_stat(transmit_server_data)
+  if not stat then
+    local path = Path:new(transmit_server_data)
     local success = pcall(function() path:write('{}', 'w') end)
     if not success then
       log(LOG_LEVELS.ERROR, "Failed to create transmit.json", true)
       return nil
     end
+    invalidate_transmit_data()
     return {}
   end
-  
-  local success, result = pcall(vim.json.decode, path:read())
+
+  if data_cache.data
+    and stat.size == data_cache.size
+    and stat.mtime.sec == data_cache.mtime_sec
+    and stat.mtime.nsec == data_cache.mtime_nsec then
+    return data_cache.data
+  end
+
+  local success, result = pcall(vim.json.decode, Path:new(transmit_server_data):read())
   if not success then
     log(LOG_LEVELS.ERROR, "Failed to parse transmit.json: " .. tostring(result), true)
     return {}
   end
-  
+
+  data_cache.data = result
+  data_cache.size = stat.size
+  data_cache.mtime_sec = stat.mtime.sec
+  data_cache.mtime_nsec = stat.mtime.nsec
+  data_cache.remote_bases = {}
   return result
 end
 
@@ -283,33 +754,6 @@ local function get_selected_server()
   return nil
 end
 
----Reset the keepalive timer
----@return nil
-local function reset_keepalive_timer()
-  if state.keepalive_timer then
-    state.keepalive_timer:stop()
-    state.keepalive_timer:close()
-  end
-  state.keepalive_timer = uv.new_timer()
-  state.keepalive_timer:start(config.keepalive_timeout, 0, function()
-    vim.schedule(function()
-      if state.transmit_job then
-        vim.fn.chansend(state.transmit_job, "exit\n")
-        state.transmit_job = nil
-        state.transmit_phase = PHASE.INIT
-        state.connecting = false
-        state.connection_ready = false
-        log(LOG_LEVELS.INFO, "SFTP connection closed after inactivity timeout", true)
-      end
-      if state.keepalive_timer then
-        state.keepalive_timer:stop()
-        state.keepalive_timer:close()
-        state.keepalive_timer = nil
-      end
-    end)
-  end)
-end
-
 ---Start authentication timeout timer
 ---@return nil
 local function start_auth_timeout()
@@ -349,32 +793,84 @@ local function stop_auth_timeout()
   end
 end
 
----Check and potentially rotate log file (called periodically)
----@param log_file_path string Path to the log file
----@return file*|nil log_file The opened log file or nil on error
-local function get_log_file(log_file_path)
-  state.log_check_counter = state.log_check_counter + 1
-  
-  local log_file = io.open(log_file_path, "a")
-  if not log_file then
-    return nil
+---Map a local path under a working directory to its remote path
+---@param config_data ServerConfig The selected server configuration
+---@param working_dir string The working directory
+---@param file string Local path under working_dir
+---@return string|nil remote_path, string|nil err The remote path, or nil and an error message
+local function resolve_remote_path(config_data, working_dir, file)
+  local data = get_transmit_data()
+  if not data then
+    return nil, nil
   end
-  
-  if state.log_check_counter >= config.log_check_interval then
-    state.log_check_counter = 0
-    local stat = vim.loop.fs_stat(log_file_path)
-    if stat and stat.size > config.log_rotation_size then
-      log_file:close()
-      local clear_file = io.open(log_file_path, "w")
-      if clear_file then
-        clear_file:close()
-        log(LOG_LEVELS.WARN, "Transmit log file exceeded size limit and was cleared", true)
+
+  -- Remote base per project root, rebuilt when transmit.json or the server
+  -- config changes
+  local cached = data_cache.remote_bases[working_dir]
+  if not cached or cached.config ~= config_data then
+    if not data[working_dir] or not data[working_dir].remote then
+      return nil, "No remote configured for working directory: " .. working_dir
+    end
+
+    local remote_base = config_data.remotes[data[working_dir].remote]
+    if not remote_base then
+      return nil, "Remote '" .. data[working_dir].remote .. "' not found in server config"
+    end
+
+    cached = { config = config_data, base = remote_base, prefix = "^" .. escapePattern(working_dir) }
+    data_cache.remote_bases[working_dir] = cached
+  end
+
+  local relative = file:gsub(cached.prefix, "")
+  return cached.base .. relative, nil
+end
+
+---Send pending prewarm hints to a connected helper
+---@return nil
+local function flush_prewarm()
+  local pending = state.prewarm_pending
+  state.prewarm_pending = {}
+
+  -- Older helpers would answer an unknown command with a 0| line, which
+  -- reads as the completion of whatever upload is in flight
+  if not state.transmit_job or state.helper_protocol < 3 then
+    return
+  end
+
+  for remote_dir in pairs(pending) do
+    if not state.prewarmed[remote_dir] then
+      state.prewarmed[remote_dir] = true
+      log(LOG_LEVELS.DEBUG, "Prewarming remote directory " .. remote_dir)
+      vim.fn.chansend(state.transmit_job, "prewarm " .. remote_dir .. "\n")
+    end
+  end
+end
+
+---Register the selected server's hooks with a freshly connected helper. A
+---remote's commands run as one `&&` chain, once per batch of transfers.
+---@return nil
+local function register_hooks()
+  if not state.transmit_job or state.helper_protocol < 9 then
+    return
+  end
+  local config_data = sftp.get_sftp_server_config()
+  if not config_data or not config_data.hooks then
+    return
+  end
+
+  local quiet_ms = math.floor((config_data.hook_quiet_period or config.hook_quiet_period) * 1000)
+  for remote_name, commands in pairs(config_data.hooks) do
+    local root = config_data.remotes and config_data.remotes[remote_name]
+    if not root then
+      log(LOG_LEVELS.WARN, "Hook configured for unknown remote " .. remote_name, true)
+    else
+      if type(commands) == "table" then
+        commands = table.concat(commands, " && ")
       end
-      log_file = io.open(log_file_path, "a")
+      log(LOG_LEVELS.DEBUG, "Registering hook for " .. root .. ": " .. commands)
+      vim.fn.chansend(state.transmit_job, string.format("hook %s %d %s\n", root, quiet_ms, (commands:gsub("\n", " "))))
     end
   end
-  
-  return log_file
 end
 
 ---Ensure SFTP connection is established, creating one if needed
@@ -383,11 +879,11 @@ end
 function sftp.ensure_connection(callback)
 	if state.transmit_job and state.connection_ready then
 		if callback then callback() end
-		reset_keepalive_timer()
 		return true
 	end
 	if state.connecting then return false end
 	state.connecting = true
+	status_changed()
 
 	local config_data = sftp.get_sftp_server_config()
 	if not config_data then
@@ -408,27 +904,66 @@ function sftp.ensure_connection(callback)
 
 	log(LOG_LEVELS.INFO, "Starting SFTP connection to " .. config_data.credentials.host)
 
-	state.transmit_job = vim.fn.jobstart({ transmit_executable }, {
+	-- The helper owns the idle policy: it keeps the session warm with SSH
+	-- keepalives and only drops it after a long idle period
+	local cmd = {
+		transmit_executable,
+		"--keepalive", tostring(config.ssh_keepalive_interval),
+		"--idle-timeout", tostring(config.idle_timeout),
+		"--save-latency", tostring(config.save_latency),
+	}
+	if config_data.standby then
+		-- Keep a warm spare session so a dropped link fails over instantly
+		table.insert(cmd, "--standby")
+	end
+	-- Per-account state files the helper keeps next to transmit.json
+	local account = (config_data.credentials.username .. "@" .. config_data.credentials.host):gsub("[^%w%.%-_@]", "_")
+	if config.journal then
+		-- The helper replays whatever a crashed predecessor left unfinished
+		-- before taking new commands
+		table.insert(cmd, "--journal")
+		table.insert(cmd, string.format("%s/transmit-%s.journal", data_path, account))
+	end
+	-- What the server supports is probed once and reused while its host key
+	-- stays the same
+	table.insert(cmd, "--capabilities")
+	table.insert(cmd, string.format("%s/transmit-%s.caps", data_path, account))
+
+	state.stdout_partial = ""
+	state.replay_settled = false
+	state.replayed = {}
+	state.transmit_job = vim.fn.jobstart(cmd, {
 		stdout_buffered = false,
 		stderr_buffered = false,
 		pty = false,
 		on_stdout = function(_, data)
-			local log_file_path = vim.fn.stdpath("cache") .. "/sftp_log.txt"
-			local log_file = get_log_file(log_file_path)
+			local timestamp = os.date("[%Y-%m-%d %H:%M:%S] ")
+			local progress_path = nil
 
-			if not log_file then
-				log(LOG_LEVELS.WARN, "Failed to open SFTP log file")
-				return
+			-- A chunk can end mid-line: its first element continues the last
+			-- one of the previous chunk, and its last element is held back
+			-- until the next. Completions are matched to queue items by
+			-- position, so a split line must never be read as two.
+			data[1] = state.stdout_partial .. data[1]
+			state.stdout_partial = table.remove(data)
+			local complete = #data
+			-- The login prompts end without a newline; each phase only matches
+			-- its own, so trying the held-back text again later is harmless
+			if state.transmit_phase ~= PHASE.READY and state.transmit_phase ~= PHASE.ACTIVE
+				and state.stdout_partial ~= "" then
+				table.insert(data, state.stdout_partial)
 			end
 
-			local timestamp_format = "[%Y-%m-%d %H:%M:%S] "
-			local progress_path = nil
+			for index, line in ipairs(data) do
+				if index <= complete then
+					helper_log:write(timestamp .. line)
+				end
 
-			for _, line in ipairs(data) do
-				local timestamp = os.date(timestamp_format)
-				log_file:write(timestamp .. line .. "\n")
+				local protocol = line:match("^PROTOCOL|(%d+)")
+				if protocol then
+					state.helper_protocol = tonumber(protocol)
 
-				if state.transmit_phase == PHASE.INIT and line:match("Enter SSH hostname") then
+				elseif state.transmit_phase == PHASE.INIT and line:match("Enter SSH hostname") then
 					vim.fn.chansend(state.transmit_job, config_data.credentials.host .. "\n")
 					state.transmit_phase = PHASE.USERNAME
 
@@ -442,6 +977,9 @@ function sftp.ensure_connection(callback)
 
 					if auth_type == "password" then
 						state.transmit_phase = PHASE.PASSWORD
+					elseif auth_type == "agent" then
+						-- Keys come from ssh-agent; nothing more to send
+						state.transmit_phase = PHASE.READY
 					else
 						state.transmit_phase = PHASE.KEY
 					end
@@ -458,9 +996,13 @@ function sftp.ensure_connection(callback)
 					state.transmit_phase = PHASE.ACTIVE
 					state.connecting = false
 					state.connection_ready = true
+					status_changed()
 					stop_auth_timeout()
 					log(LOG_LEVELS.INFO, "SFTP connection established", true)
+					-- Before anything is sent, so the first batch already counts
+					register_hooks()
 					if callback then callback() end
+					flush_prewarm()
 
 				elseif state.transmit_phase == PHASE.ACTIVE then
 					if line:match("^PROGRESS|") then
@@ -473,19 +1015,83 @@ function sftp.ensure_connection(callback)
 							end
 							state.current_progress.file = progress_path:make_relative()
 							state.current_progress.percent = percent
+							status_changed()
 						else
 							log(LOG_LEVELS.WARN, "Invalid progress data: " .. line)
 						end
-					elseif line:match("^1|Upload succeeded") or line:match("^1|Remove succeeded") or line:match("^0|") then
+					elseif line:match("^RECONNECT|") then
+						-- The helper is re-establishing the session itself; the queue stays put
+						local attempt, delay = line:match("^RECONNECT|(%d+)|(%d+)")
+						log(LOG_LEVELS.WARN, string.format("SFTP link dropped, helper reconnecting (attempt %s, %sms)", attempt or "?", delay or "?"), attempt == "1")
+					elseif line:match("^RECONNECTED|") then
+						log(LOG_LEVELS.INFO, "SFTP session re-established by helper", true)
+					elseif line:match("^FAILOVER|") then
+						log(LOG_LEVELS.INFO, "SFTP link dropped, switched to standby session", true)
+					elseif line:match("^IDLE|") then
+						log(LOG_LEVELS.INFO, "SFTP session idle, helper dropped it until next use")
+					elseif line:match("^CREDIT|") then
+						local granted = tonumber(line:match("^CREDIT|(%d+)"))
+						if granted then
+							state.credit_based = true
+							state.credits = state.credits + granted
+							sftp.process_next()
+						end
+					elseif line:match("^REPLAY|") then
+						local status, op, remote_path = line:match("^REPLAY|(%a+)|(%a+)|([^|]*)")
+						log(status == "failed" and LOG_LEVELS.WARN or LOG_LEVELS.INFO,
+							string.format("Resumed %s of %s from journal: %s", op or "?", remote_path or "?", status or "?"),
+							status == "failed")
+						-- Failed ones are still wanted; they go out with the resends
+						if op and status ~= "failed" then
+							state.replayed[op .. "|" .. remote_path] = true
+						end
+					elseif line:match("^REPLAYED|") then
+						settle_replayed()
+						sftp.process_next()
+					elseif line:match("^PREWARM|") then
+						local status, remote_dir = line:match("^PREWARM|(%a+)|(.*)")
+						log(LOG_LEVELS.DEBUG, string.format("Prewarm %s: %s", remote_dir or "?", status or "?"))
+					elseif line:match("^DEFINE|") then
+						local name, status, reason = line:match("^DEFINE|([^|]*)|(%a+)|?(.*)")
+						if status ~= "ok" then
+							state.defined[name or ""] = nil
+							log(LOG_LEVELS.ERROR, string.format("Helper rejected server %s: %s", name or "?", reason or "?"), true)
+						end
+					elseif line:match("^HOOK|") then
+						local root, kind, rest = line:match("^HOOK|([^|]*)|(%a+)|(.*)")
+						if kind == "ran" then
+							local status, duration, output = rest:match("^(-?%d+)|(%d+)|(.*)")
+							local run = {
+								root = root,
+								status = tonumber(status) or -1,
+								duration_ms = tonumber(duration) or 0,
+								output = output or "",
+								finished_at = os.time(),
+							}
+							state.hook_runs[root] = run
+							state.last_hook = run
+							status_changed()
+							log(run.status == 0 and LOG_LEVELS.INFO or LOG_LEVELS.ERROR,
+								string.format("Hook for %s exited %d after %d ms%s", root, run.status, run.duration_ms,
+									run.output ~= "" and (": " .. run.output) or ""),
+								run.status ~= 0)
+						else
+							log(LOG_LEVELS.ERROR, string.format("Helper rejected hook for %s: %s", root or "?", rest or "?"), true)
+						end
+					elseif line:match("^RELEASE|") then
+						local status, live, dir = line:match("^RELEASE|(%a+)|([^|]*)|(.*)")
+						log(LOG_LEVELS.INFO, string.format("Release %s for %s: %s", status or "?", live or "?", dir or "?"), status == "live")
+					elseif line:match("^1|Upload succeeded") or line:match("^1|Remove succeeded")
+						or line:match("^1|Copy succeeded") or line:match("^1|Release succeeded") or line:match("^0|") then
 						local current_item = get_current_queue_item()
 						if current_item and current_item.processing then
 							log(LOG_LEVELS.DEBUG, "Completed " .. current_item.type .. " for " .. current_item.filename)
 							remove_item_from_queue()
+							state.in_flight = math.max(state.in_flight - 1, 0)
 							state.current_progress = { file = nil, percent = nil }
-							reset_keepalive_timer()
 
 							-- ✅ ADD THIS: Check if queue is now empty
-							if #state.queue == 0 then
+							if state.queue.size == 0 then
 								vim.schedule(function()
 									vim.notify("SFTP: All uploads completed", vim.log.levels.INFO)
 								end)
@@ -496,24 +1102,28 @@ function sftp.ensure_connection(callback)
 					end
 				end
 			end
-
-			log_file:close()
 		end,
 
 		on_exit = function(_, exit_code, _)
 			state.connection_ready = false
 			state.transmit_job = nil
+			state.stdout_partial = ""
+			state.helper_protocol = 0
+			state.prewarmed = {}
+			state.defined = {}
+			state.credits = 0
+			state.credit_based = false
+			requeue_in_flight()
 			state.connecting = false
 			state.current_progress = { file = nil, percent = nil }
+			status_changed()
 			stop_auth_timeout()
 
+			-- The helper reconnects by itself; reaching this point means it gave up
+			-- or was killed, so fall back to a full respawn
 			if not state.is_exiting then
 				log(LOG_LEVELS.WARN, "SFTP connection lost (exit code " .. exit_code .. "). Reconnecting...", true)
 
-				for _, item in ipairs(state.queue) do
-					item.processing = false
-				end
-
 				sftp.ensure_connection(function()
 					sftp.process_next()
 				end)
@@ -524,71 +1134,117 @@ function sftp.ensure_connection(callback)
 	return true
 end
 
----Process the next item in the queue
----@return boolean success Returns true if an item was processed
-function sftp.process_next()
-  local item = get_current_queue_item()
-  if not item then
-    return false
+---Make sure the helper knows both servers of a copy item
+---@param item QueueItem A copy item
+---@return string|nil err Why the copy can't be sent
+local function define_copy_endpoints(item)
+  if state.helper_protocol < 7 then
+    return "The transmit helper is too old for remote-to-remote copies"
   end
 
-  if item.processing then
-    return false
+  for _, spec in ipairs({ item.filename, item.target }) do
+    local name = spec:match("^([^:]+):")
+    local server = name and state.server_config[name]
+    if not server then
+      return "Unknown server in " .. spec
+    end
+    local credentials = server.credentials
+    if credentials.auth_type == "password" then
+      return "Copies need key or agent authentication for " .. name
+    end
+    if not state.defined[name] then
+      local method = credentials.auth_type == "agent" and "agent" or "key"
+      local key = credentials.identity_file and vim.fn.expand(credentials.identity_file) or ""
+      vim.fn.chansend(state.transmit_job, string.format("define %s %s@%s %s %s\n",
+        name, credentials.username, credentials.host, method, key))
+      state.defined[name] = true
+    end
   end
+  return nil
+end
 
-  local config_data = sftp.get_sftp_server_config()
-  if not config_data then
-    log(LOG_LEVELS.ERROR, "No SFTP server configuration found", true)
-    return false
-  end
-  
-  local data = get_transmit_data()
-  if not data then
-    return false
-  end
-  
-  local cwd = item.working_dir
-  local file = item.filename
-  local relative = file:gsub(escapePattern(cwd), "")
-  
-  if not data[cwd] or not data[cwd].remote then
-    log(LOG_LEVELS.ERROR, "No remote configured for working directory: " .. cwd, true)
-    remove_item_from_queue()
-    return false
-  end
-  
-  local remote_base = config_data.remotes[data[cwd].remote]
-  if not remote_base then
-    log(LOG_LEVELS.ERROR, "Remote '" .. data[cwd].remote .. "' not found in server config", true)
-    remove_item_from_queue()
+---Send queued items to the helper while the credit window allows
+---@return boolean success Returns true if at least one item was sent
+function sftp.process_next()
+  if not state.transmit_job or not state.connection_ready then
     return false
   end
-  
-  local remote_path = remote_base .. relative
 
-  local cmd = nil
-  if item.type == OPERATION_TYPE.UPLOAD then
-    cmd = string.format("upload %s %s\n", file, remote_path)
-  elseif item.type == OPERATION_TYPE.REMOVE then
-    cmd = string.format("remove %s\n", remote_path)
+  local sent = false
+
+  while has_send_budget() do
+    local item = next_unsent_item()
+    if not item then
+      break
+    end
+
+    local config_data = sftp.get_sftp_server_config()
+    if not config_data then
+      log(LOG_LEVELS.ERROR, "No SFTP server configuration found", true)
+      break
+    end
+
+    local file = item.filename
+    local remote_path, err
+    if item.type == OPERATION_TYPE.COPY then
+      -- Both ends are already remote; they only need to be defined
+      remote_path, err = item.target, define_copy_endpoints(item)
+      if err then
+        remote_path = nil
+      end
+    elseif item.type == OPERATION_TYPE.RELEASE and state.helper_protocol < 8 then
+      err = "The transmit helper is too old for releases"
+    else
+      remote_path, err = resolve_remote_path(config_data, item.working_dir, file)
+    end
+    if not remote_path then
+      if not err then
+        break
+      end
+      log(LOG_LEVELS.ERROR, err, true)
+      cancel_item(item)
+    else
+      local cmd = nil
+      if item.type == OPERATION_TYPE.UPLOAD then
+        cmd = string.format("upload %s %s", file, remote_path)
+      elseif item.type == OPERATION_TYPE.REMOVE then
+        cmd = string.format("remove %s", remote_path)
+      elseif item.type == OPERATION_TYPE.COPY then
+        cmd = string.format("copy %s %s", file, remote_path)
+      elseif item.type == OPERATION_TYPE.RELEASE then
+        cmd = string.format("release %s %s", item.action, remote_path)
+      end
+      -- Tell the helper which flow the item belongs to, so a sync in one
+      -- project is scheduled fairly against saves and other projects
+      if state.helper_protocol >= 5 then
+        cmd = string.format("%s %s:%s", cmd, item.bulk and "bulk" or "save", item.working_dir)
+      end
+      cmd = cmd .. "\n"
+
+      item.remote_path = remote_path
+      mark_sent(item)
+      unindex_pending(item)
+      state.in_flight = state.in_flight + 1
+      state.credits = state.credits - 1
+      log(LOG_LEVELS.DEBUG, "Processing " .. item.type .. " for " .. item.filename)
+      vim.fn.chansend(state.transmit_job, cmd)
+      sent = true
+    end
   end
 
-  if cmd then
-    item.processing = true
-    log(LOG_LEVELS.DEBUG, "Processing " .. item.type .. " for " .. item.filename)
-    vim.fn.chansend(state.transmit_job, cmd)
-    return true
+  if sent then
+    status_changed()
   end
-  
-  return false
+  return sent
 end
 
 ---Add a file operation to the queue
 ---@param type "upload"|"remove" The operation type
 ---@param filename string The local file path
 ---@param working_dir string The working directory
+---@param bulk boolean|nil Part of a batch; saves are sent ahead of unsent bulk items
 ---@return number|nil queue_id Returns queue item ID on success, nil on failure
-function sftp.add_to_queue(type, filename, working_dir)
+function sftp.add_to_queue(type, filename, working_dir, bulk)
   if not type or (type ~= OPERATION_TYPE.UPLOAD and type ~= OPERATION_TYPE.REMOVE) then
     log(LOG_LEVELS.ERROR, "Invalid operation type: " .. tostring(type), true)
     return nil
@@ -604,16 +1260,36 @@ function sftp.add_to_queue(type, filename, working_dir)
     return nil
   end
 
+  -- An unsent item for this file absorbs the request; the latest operation
+  -- wins. One queued before a release step can't: the request belongs after it.
+  local latest = state.pending_by_file[filename]
+  if latest and not (state.release_item and latest.id < state.release_item.id) then
+    if latest.type ~= type then
+      log(LOG_LEVELS.DEBUG, "Replacing queued " .. latest.type .. " with " .. type .. " [" .. latest.id .. "]: " .. filename)
+      latest.type = type
+      queue_changed()
+    end
+    -- A save landing on an item of a sync is still a save
+    if latest.list == state.queue.bulk and not bulk then
+      log(LOG_LEVELS.DEBUG, "Promoting queued " .. latest.type .. " to a save [" .. latest.id .. "]: " .. filename)
+      promote_to_save(latest)
+    end
+    return latest.id
+  end
+
   local queue_id = state.next_queue_id
   state.next_queue_id = state.next_queue_id + 1
 
-  table.insert(state.queue, {
+  local item = {
     id = queue_id,
     type = type,
     filename = filename,
     working_dir = working_dir,
     processing = false,
-  })
+    bulk = bulk or nil,
+  }
+  push_queue_item(item)
+  state.pending_by_file[filename] = item
 
   log(LOG_LEVELS.DEBUG, "Added to queue [" .. queue_id .. "]: " .. type .. " " .. filename)
 
@@ -624,11 +1300,183 @@ function sftp.add_to_queue(type, filename, working_dir)
   return queue_id
 end
 
+---Queue a copy from one configured server to another. The helper streams
+---it between the two sessions without touching the local disk.
+---@param source string `server:path` to copy from (a file or a directory)
+---@param target string `server:path` to copy to
+---@return number|nil queue_id Returns queue item ID on success, nil on failure
+function sftp.add_copy(source, target)
+  for _, spec in ipairs({ source or "", target or "" }) do
+    local name, path = spec:match("^([^:]+):(.+)$")
+    if not name or not path then
+      log(LOG_LEVELS.ERROR, "Expected server:path, got " .. spec, true)
+      return nil
+    end
+    if not state.server_config[name] then
+      log(LOG_LEVELS.ERROR, "Unknown server: " .. name, true)
+      return nil
+    end
+  end
+
+  local queue_id = state.next_queue_id
+  state.next_queue_id = state.next_queue_id + 1
+  push_queue_item({
+    id = queue_id,
+    type = OPERATION_TYPE.COPY,
+    filename = source,
+    target = target,
+    working_dir = vim.loop.cwd(),
+    processing = false,
+    bulk = true,
+  })
+
+  log(LOG_LEVELS.DEBUG, "Added to queue [" .. queue_id .. "]: copy " .. source .. " -> " .. target)
+
+  sftp.ensure_connection(function()
+    sftp.process_next()
+  end)
+
+  return queue_id
+end
+
+---Queue a step of an atomic release of a project. After "begin" the helper
+---redirects uploads and removes under the project's remote into a new
+---release directory seeded with hardlinks of the live one; "commit" points
+---the remote (a symlink) at it in one rename, "abort" discards it.
+---@param action "begin"|"commit"|"abort" Release step
+---@param working_dir string Project root whose remote is the live symlink
+---@return number|nil queue_id Returns queue item ID on success, nil on failure
+function sftp.add_release(action, working_dir)
+  if action ~= "begin" and action ~= "commit" and action ~= "abort" then
+    log(LOG_LEVELS.ERROR, "Invalid release step: " .. tostring(action), true)
+    return nil
+  end
+
+  local queue_id = state.next_queue_id
+  state.next_queue_id = state.next_queue_id + 1
+  -- Behind all bulk items, so whatever was queued before a step is sent
+  -- before it; saves queued after it wait for it
+  local item = {
+    id = queue_id,
+    type = OPERATION_TYPE.RELEASE,
+    action = action,
+    filename = working_dir,
+    working_dir = working_dir,
+    processing = false,
+    bulk = true,
+  }
+  push_queue_item(item)
+  state.release_item = item
+
+  log(LOG_LEVELS.DEBUG, "Added to queue [" .. queue_id .. "]: release " .. action .. " " .. working_dir)
+
+  sftp.ensure_connection(function()
+    sftp.process_next()
+  end)
+
+  return queue_id
+end
+
+---Queue again what an earlier session left unsent, in its original order.
+---Items a dead helper had accepted wait for the next helper's journal
+---replay, like any other resend.
+---@return number count Items resumed
+function sftp.resume_queue()
+  local file = io.open(queue_file, "r")
+  if not file then
+    return 0
+  end
+  local ok, entries = pcall(vim.json.decode, file:read("*a"))
+  file:close()
+  if not ok or type(entries) ~= "table" then
+    log(LOG_LEVELS.WARN, "Ignoring unreadable queue file " .. queue_file)
+    return 0
+  end
+
+  local known = {}
+  for _, kind in pairs(OPERATION_TYPE) do
+    known[kind] = true
+  end
+
+  local count = 0
+  for _, entry in ipairs(entries) do
+    local per_file = type(entry) == "table"
+      and (entry.type == OPERATION_TYPE.UPLOAD or entry.type == OPERATION_TYPE.REMOVE)
+    if type(entry) == "table" and known[entry.type] and type(entry.filename) == "string"
+      and type(entry.working_dir) == "string"
+      and not (per_file and state.pending_by_file[entry.filename]) then
+      local item = {
+        id = state.next_queue_id,
+        type = entry.type,
+        filename = entry.filename,
+        target = entry.target,
+        action = entry.action,
+        working_dir = entry.working_dir,
+        processing = false,
+        bulk = entry.bulk or nil,
+        remote_path = entry.remote_path,
+      }
+      state.next_queue_id = state.next_queue_id + 1
+      push_queue_item(item)
+      if item.remote_path then
+        list_unlink(item)
+        list_push(state.queue.resend, item)
+      end
+      if per_file then
+        state.pending_by_file[item.filename] = item
+      elseif item.type == OPERATION_TYPE.RELEASE then
+        state.release_item = item
+      end
+      count = count + 1
+    end
+  end
+
+  if count > 0 then
+    log(LOG_LEVELS.INFO, string.format("Resuming %d queued operation(s) from the last session", count), true)
+    sftp.ensure_connection(function()
+      sftp.process_next()
+    end)
+  end
+  return count
+end
+
+---Connect early and have the helper cache the remote directory of a path,
+---so the first save of a session skips the handshake and directory lookups
+---@param working_dir string The working directory
+---@param file string|nil Local file whose directory to prewarm (defaults to the project root)
+---@return boolean success Returns true if a hint was sent or is already cached
+function sftp.prewarm(working_dir, file)
+  if not config.prewarm then
+    return false
+  end
+
+  local config_data = sftp.get_sftp_server_config()
+  if not config_data then
+    return false
+  end
+
+  local local_dir = file and vim.fn.fnamemodify(file, ":h") or working_dir
+  local remote_dir = resolve_remote_path(config_data, working_dir, local_dir)
+  if not remote_dir then
+    return false
+  end
+
+  if state.prewarmed[remote_dir] then
+    return true
+  end
+
+  -- Held until the session is up; a connect already in flight flushes it too
+  state.prewarm_pending[remote_dir] = true
+  sftp.ensure_connection(flush_prewarm)
+
+  return true
+end
+
 ---Cancel a queued operation by ID
 ---@param queue_id number The queue item ID to cancel
 ---@return boolean success Returns true if item was cancelled
 function sftp.cancel_queue_item(queue_id)
-  local item, index = find_queue_item(queue_id)
+  local item = find_queue_item(queue_id)
   
   if not item then
     log(LOG_LEVELS.WARN, "Queue item not found: " .. queue_id)
@@ -640,7 +1488,7 @@ function sftp.cancel_queue_item(queue_id)
     return false
   end
   
-  table.remove(state.queue, index)
+  cancel_item(item)
   log(LOG_LEVELS.INFO, "Cancelled queue item [" .. queue_id .. "]: " .. item.filename)
   return true
 end
@@ -649,14 +1497,11 @@ end
 ---@return number count Number of items cleared
 function sftp.clear_queue()
   local cleared = 0
-  local i = 1
-  
-  while i <= #state.queue do
-    if not state.queue[i].processing then
-      table.remove(state.queue, i)
+
+  for item in iter_queue() do
+    if not item.processing then
+      cancel_item(item)
       cleared = cleared + 1
-    else
-      i = i + 1
     end
   end
   
@@ -745,6 +1590,8 @@ function sftp.update_transmit_server_config(server_name, remote)
   local success, err = pcall(function()
     Path:new(transmit_server_data):write(vim.json.encode(data), 'w')
   end)
+  -- The table above was edited in place; reload it from disk next time
+  invalidate_transmit_data()
   
   if not success then
     log(LOG_LEVELS.ERROR, "Failed to save transmit config: " .. tostring(err), true)
@@ -770,16 +1617,44 @@ function sftp.get_progress()
   return state.current_progress
 end
 
+---Get the last published status summary
+---Statuslines should redraw on `User TransmitProgress` and read this (or the
+---event's data) instead of polling the queue
+---@return TransmitStatus status Shared table; treat it as read-only
+function sftp.get_status()
+  if not state.status then
+    state.status = build_status()
+  end
+  return state.status
+end
+
+---Get the last hook run per remote root
+---@return table<string, HookRun> runs Shared table; treat it as read-only
+function sftp.get_hook_runs()
+  return state.hook_runs
+end
+
 ---Get the number of items in the queue (O(1))
 ---@return number count Number of items in queue
 function sftp.queue_length()
-  return #state.queue
+  return state.queue.size
 end
 
 ---Get all queue items
+---The items are the live queue entries, not copies; treat them as read-only
 ---@return QueueItem[] items All items in the queue
 function sftp.get_queue()
-  return vim.deepcopy(state.queue)
+  local items = {}
+  for item in iter_queue() do
+    items[#items + 1] = item
+  end
+  return items
+end
+
+---Iterate over queue items without building a list
+---@return fun(): QueueItem|nil iterator Yields live items, oldest first
+function sftp.iter_queue()
+  return iter_queue()
 end
 
 ---Get connection status
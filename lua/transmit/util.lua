@@ -49,8 +49,9 @@ end
 ---Remove a path from the remote server
 ---@param path string|nil Optional path to remove (defaults to current buffer file)
 ---@param working_dir string|nil Optional working directory (defaults to current working directory)
+---@param bulk boolean|nil Part of a batch rather than an interactive save
 ---@return number|nil queue_id Returns queue item ID on success, nil on failure
-function util.remove_path(path, working_dir)
+function util.remove_path(path, working_dir, bulk)
   -- Default to current buffer file if no path provided
   if path == nil then
     path = vim.api.nvim_buf_get_name(0)
@@ -81,7 +82,7 @@ function util.remove_path(path, working_dir)
   end
   
   -- Add to queue
-  local queue_id = sftp.add_to_queue("remove", path, working_dir)
+  local queue_id = sftp.add_to_queue("remove", path, working_dir, bulk)
   
   return queue_id
 end
@@ -89,8 +90,9 @@ end
 ---Upload a file to the remote server
 ---@param file string|nil Optional file path (defaults to current buffer file)
 ---@param working_dir string|nil Optional working directory (defaults to current working directory)
+---@param bulk boolean|nil Part of a batch rather than an interactive save
 ---@return number|nil queue_id Returns queue item ID on success, nil on failure
-function util.upload_file(file, working_dir)
+function util.upload_file(file, working_dir, bulk)
   -- Default to current buffer file if no file provided
   if file == nil then
     file = vim.api.nvim_buf_get_name(0)
@@ -128,7 +130,7 @@ function util.upload_file(file, working_dir)
   end
   
   -- Add to queue
-  local queue_id = sftp.add_to_queue("upload", file, working_dir)
+  local queue_id = sftp.add_to_queue("upload", file, working_dir, bulk)
   
   return queue_id
 end
@@ -167,7 +169,7 @@ function util.upload_files(files, working_dir)
   for _, file in ipairs(files) do
     local valid_file, _ = validate_file_path(file)
     if valid_file then
-      local queue_id = sftp.add_to_queue("upload", file, working_dir)
+      local queue_id = sftp.add_to_queue("upload", file, working_dir, true)
       if queue_id then
         table.insert(queue_ids, queue_id)
         success_count = success_count + 1
@@ -223,7 +225,7 @@ function util.remove_paths(paths, working_dir)
   local success_count = 0
   
   for _, path in ipairs(paths) do
-    local queue_id = sftp.add_to_queue("remove", path, working_dir)
+    local queue_id = sftp.add_to_queue("remove", path, working_dir, true)
     if queue_id then
       table.insert(queue_ids, queue_id)
       success_count = success_count + 1
@@ -1,57 +1,1839 @@
+#define _GNU_SOURCE  // asprintf
 #include <stdbool.h>
+#include <pthread.h>
 #include <libssh2.h>
 #include <libssh2_sftp.h>
 #include "transmit.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
-int main() {
-    char hostname[256], username[128], auth_method[16];
-    char privkey_path[256], password[256];
-    char input[512];
-    char command[32], arg1[256], arg2[256];
-    LIBSSH2_SFTP *sftp_session = NULL;
-    LIBSSH2_SESSION *session = NULL;
-    int sock;
+#define DEFAULT_KEEPALIVE_SECONDS 30
+#define KEEPALIVE_PROBE_TIMEOUT_MS 10000
+
+// A blocking libssh2 call during an upload or remove is treated as hung once
+// it has made no progress for this long plus OP_STALL_SLACK times what its
+// payload needs at the measured throughput. It then fails with
+// LIBSSH2_ERROR_TIMEOUT and the operation is retried on a fresh session.
+#define OP_STALL_BASE_MS 15000
+#define OP_STALL_SLACK 4
+// Throughput assumed until an upload has been measured
+#define OP_FLOOR_BYTES_PER_SEC (32 * 1024)
+
+// Upload/remove commands a frontend may have outstanding. Each result hands
+// one credit back, so neither our stdin nor the frontend's in-flight list
+// grows with the size of a sync. It also bounds how far ahead the transfer
+// pool can look when picking the cheapest job.
+#define COMMAND_WINDOW 64
+
+// Files at least this large may go over SCP instead of SFTP. Below it the
+// per-transfer setup dominates and SFTP's open handle wins anyway.
+#define SCP_MIN_BYTES (1024 * 1024)
+// Weight of the newest sample in each transport's throughput average
+#define TRANSPORT_EWMA_ALPHA 0.3
+// Every Nth large upload goes over the slower transport to keep its
+// measurement current as link conditions change
+#define TRANSPORT_EXPLORE_EVERY 8
+
+// Connections the transfer pool may open, including the primary one
+#define MAX_TRANSFER_CONNECTIONS 8
+// Extra connections are closed after this long without work
+#define WORKER_IDLE_SECONDS 30
+// Aggregate throughput gain another connection must bring to be kept
+#define RAMP_MIN_GAIN 1.10
+// Each connection count is measured at least this long before ramping on
+#define RAMP_WINDOW_SECONDS 1.0
+// After an extra connection fails without the server refusing it, no other
+// is opened for this long
+#define CONNECT_RETRY_SECONDS 10.0
+// execute_command result when an extra worker's connection died under the
+// job; the job is requeued and the pool decides about a new connection
+#define RESULT_LINK_LOST (-2)
+// Fixed per-file cost in bytes-equivalent (open, close, round trips), so
+// batches of small files are weighed fairly against large streams
+#define FILE_OVERHEAD_BYTES (64 * 1024)
+// Cheaper jobs may overtake a waiting one at most this many times, so a
+// large file can't starve behind a steady stream of small ones
+#define SJF_MAX_BYPASS 32
+
+// Jobs are grouped into flows by the optional "<class>:<project>" tag
+// frontends append to a command, and flows share the workers by deficit
+// round robin. Flow 0 takes untagged and replayed jobs.
+#define MAX_FLOWS 16
+// Cost a bulk flow may spend per round; save flows get SAVE_FLOW_WEIGHT times more
+#define DRR_QUANTUM_BYTES (256 * 1024)
+#define SAVE_FLOW_WEIGHT 8
+// A save waiting longer than this gets a connection of its own
+#define DEFAULT_SAVE_LATENCY_SECONDS 2
+
+// Servers a frontend may define for remote-to-remote copies
+#define MAX_DEFINED_SERVERS 8
+
+// Hook commands a frontend may register, one per remote root
+#define MAX_HOOKS 16
+// A hook still running after this long is reported as timed out
+#define HOOK_TIMEOUT_MS 120000
+
+typedef enum { TRANSPORT_SFTP, TRANSPORT_SCP, TRANSPORT_COUNT } transport_kind;
+
+// Measured throughput of large uploads per transport, used to pick the
+// faster one automatically. Shared by all transfer workers.
+typedef struct {
+    pthread_mutex_t lock;
+    double bytes_per_sec[TRANSPORT_COUNT]; // EWMA, 0 until sampled
+    unsigned samples[TRANSPORT_COUNT];
+    unsigned large_uploads;
+    bool scp_unavailable;                  // server refused an SCP channel
+} transport_stats;
+
+typedef struct {
+    bool want_standby;
+    const char *journal_path; // NULL = no journal
+    const char *capabilities_path; // NULL = don't persist server capabilities
+    int keepalive_interval;   // seconds between liveness probes while idle
+    int idle_timeout;         // seconds idle before the session is dropped, 0 = never
+    int save_latency;         // seconds a save may wait for a worker, 0 = no bound
+} helper_options;
+
+// Buffered stdin reader that can give up after a timeout, so the command loop
+// can do keepalives and idle housekeeping between commands
+typedef struct {
+    char buf[8192];
+    size_t len;
+    bool eof;
+} line_reader;
+
+// One upload or remove handed to the transfer pool. Jobs may run out of
+// order on different connections, but their results are reported strictly
+// in submission order, which is what frontends match them by.
+typedef struct transfer_job {
+    struct transfer_job *next;
+    unsigned long seq;          // journal sequence, 0 if not journaled
+    char command[32];
+    char arg1[256];
+    char arg2[256];
+    const char *remote;         // remote path the job writes or removes
+    long long size;             // local size of an upload
+    bool valid;                 // false: report a usage error in its turn
+    bool started;
+    bool done;
+    bool lost;                  // failed because the primary session is gone
+    bool staged;                // redirected into the release being staged
+    unsigned bypassed;          // times a later, cheaper job started first in its flow
+    int flow;
+    double queued_at;           // monotonic_seconds() at submission
+    int rc;
+    char *err_msg;
+} transfer_job;
+
+typedef struct {
+    char name[288];             // "<class>:<project>" as sent by the frontend
+    bool save;                  // interactive saves, as opposed to bulk syncs
+    int jobs;                   // unreported jobs; the slot is reusable at 0
+    double deficit;
+} transfer_flow;
+
+// Another server a frontend defined as a copy endpoint
+typedef struct {
+    char name[64];
+    transmit_connection account;  // credentials only
+    transmit_connection idle;     // session kept from the last copy
+    bool idle_ready;
+} defined_server;
+
+// Command run on the server once transfers under root have settled
+typedef struct {
+    char root[256];
+    char command[1024];
+    int quiet_ms;               // no transfer under root for this long
+    bool dirty;                 // a transfer under root finished since the last run
+    double changed_at;          // monotonic_seconds() when the last one finished
+} remote_hook;
+
+typedef struct transfer_pool transfer_pool;
+
+typedef struct {
+    transfer_pool *pool;
+    transmit_connection conn;   // own connection; the primary worker uses pool->primary
+    bool in_use;
+} transfer_worker;
+
+// Workers each own one SSH connection. Worker 0 transfers on the primary
+// connection; more are added while a backlog exists, one at a time until
+// aggregate throughput stops improving or the server refuses a connection.
+// Only a refusal is remembered per server. A remembered ceiling is opened up
+// to at once, with the handshakes running concurrently on the new threads,
+// and measured beyond once saturated, since the server may have changed.
+struct transfer_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t work;        // a job became runnable, or stop
+    pthread_cond_t changed;     // a job finished or a worker exited
+    transfer_job *head;
+    transfer_job *tail;
+    int outstanding;            // jobs not yet reported
+    int queued;                 // valid jobs not yet started
+    int running;
+    int workers;                // workers taking jobs, including connecting ones
+    int threads;                // worker threads still alive
+    int connecting;
+    int target;                 // workers beyond this retire when free
+    int ceiling;                // connection limit, 0 = unknown
+    bool ceiling_settled;       // measured or refused in this run, not just remembered
+    double connect_retry_at;    // no extra connections before this monotonic time
+    transfer_flow flows[MAX_FLOWS];
+    int flow_cursor;            // flow the round robin serves next
+    defined_server servers[MAX_DEFINED_SERVERS];
+    int server_count;
+
+    // Release being staged: uploads and removes under release_live are
+    // redirected into release_dir from "release begin" until it is
+    // committed or aborted
+    char release_live[256];
+    char release_dir[256];
+    bool release_open;
+    unsigned release_serial;    // releases begun, to keep their names unique
+    int release_faults;         // failed steps since the last release began
+
+    remote_hook hooks[MAX_HOOKS];
+    int hook_count;
+    bool hook_thread;           // the hook runner is alive
+    bool ceiling_changed;       // a refusal lowered the ceiling; persist it
+    bool stop;
+    bool fatal;                 // the primary session is gone for good
+    int wake_fd[2];             // wakes the command loop out of its stdin wait
+
+    // Throughput of the current connection count while it is saturated
+    int window_workers;
+    double window_start;
+    double window_cost;
+    int window_jobs;
+    double best_rate;
+
+    transmit_connection *primary;
+    pthread_mutex_t primary_lock; // held while the primary connection is in use
+    transmit_standby *standby;
+    transport_stats *transports;
+    transmit_journal *journal;
+    const helper_options *opts;
+    const server_capabilities *caps;
+    time_t last_activity;       // last command or finished transfer
+    time_t last_verified;       // last time the primary session proved alive
+    transfer_worker slots[MAX_TRANSFER_CONNECTIONS];
+};
+
+// Whether a complete line is already buffered, i.e. read_line won't block
+static bool reader_has_line(const line_reader *reader) {
+    return reader->eof || memchr(reader->buf, '\n', reader->len) != NULL;
+}
+
+// Returns 1 with the next line (newline stripped) in out, 0 on timeout or
+// when wake_fd became readable, and -1 on EOF or error. A negative timeout
+// waits forever; a negative wake_fd is ignored.
+static int read_line(line_reader *reader, char *out, size_t out_size, int timeout_ms, int wake_fd) {
+    while (1) {
+        char *newline = memchr(reader->buf, '\n', reader->len);
+        if (newline || (reader->eof && reader->len > 0)) {
+            size_t line_len = newline ? (size_t)(newline - reader->buf) : reader->len;
+            size_t consumed = newline ? line_len + 1 : line_len;
+            if (line_len > 0 && reader->buf[line_len - 1] == '\r') {
+                line_len--;
+            }
+            size_t copy = line_len < out_size - 1 ? line_len : out_size - 1;
+            memcpy(out, reader->buf, copy);
+            out[copy] = '\0';
+            memmove(reader->buf, reader->buf + consumed, reader->len - consumed);
+            reader->len -= consumed;
+            return 1;
+        }
+
+        if (reader->eof) {
+            return -1;
+        }
+
+        // A line longer than the buffer can't be a valid command; drop it
+        if (reader->len == sizeof(reader->buf)) {
+            reader->len = 0;
+        }
+
+        struct pollfd pfds[2] = {
+            { .fd = STDIN_FILENO, .events = POLLIN },
+            { .fd = wake_fd, .events = POLLIN },
+        };
+        int rc = poll(pfds, wake_fd >= 0 ? 2 : 1, timeout_ms);
+        if (rc == 0) {
+            return 0;
+        }
+        if (rc < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (wake_fd >= 0 && (pfds[1].revents & POLLIN)) {
+            char drain[64];
+            while (read(wake_fd, drain, sizeof(drain)) > 0) {
+            }
+            return 0;
+        }
+
+        ssize_t n = read(STDIN_FILENO, reader->buf + reader->len, sizeof(reader->buf) - reader->len);
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+            return -1;
+        }
+        if (n == 0) {
+            reader->eof = true;
+            continue;
+        }
+        reader->len += n;
+    }
+}
+
+static double monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Transport for an upload of size bytes: measure each once, then prefer the
+// faster, with an occasional probe of the other
+static transport_kind choose_transport(transport_stats *stats, long long size) {
+    if (size < SCP_MIN_BYTES) {
+        return TRANSPORT_SFTP;
+    }
+
+    pthread_mutex_lock(&stats->lock);
+    transport_kind kind;
+    if (stats->scp_unavailable) {
+        kind = TRANSPORT_SFTP;
+    } else if (stats->samples[TRANSPORT_SCP] == 0) {
+        kind = TRANSPORT_SCP;
+    } else if (stats->samples[TRANSPORT_SFTP] == 0) {
+        kind = TRANSPORT_SFTP;
+    } else {
+        transport_kind faster = stats->bytes_per_sec[TRANSPORT_SCP] > stats->bytes_per_sec[TRANSPORT_SFTP]
+            ? TRANSPORT_SCP : TRANSPORT_SFTP;
+        kind = faster;
+        if (++stats->large_uploads % TRANSPORT_EXPLORE_EVERY == 0) {
+            kind = faster == TRANSPORT_SCP ? TRANSPORT_SFTP : TRANSPORT_SCP;
+        }
+    }
+    pthread_mutex_unlock(&stats->lock);
+    return kind;
+}
+
+static void record_transport_sample(transport_stats *stats, transport_kind kind, long long size, double seconds) {
+    if (size < SCP_MIN_BYTES || seconds <= 0) {
+        return;
+    }
+
+    double rate = size / seconds;
+    pthread_mutex_lock(&stats->lock);
+    if (stats->samples[kind] == 0) {
+        stats->bytes_per_sec[kind] = rate;
+    } else {
+        stats->bytes_per_sec[kind] = TRANSPORT_EWMA_ALPHA * rate + (1 - TRANSPORT_EWMA_ALPHA) * stats->bytes_per_sec[kind];
+    }
+    stats->samples[kind]++;
+    pthread_mutex_unlock(&stats->lock);
+}
+
+// Upload over whichever transport is currently measured faster for files of
+// this size; SCP falls back to SFTP if the server doesn't offer it or
+// rejects the file
+static int upload_with_best_transport(transmit_connection *conn, transport_stats *stats, const char *local_file, const char *remote_file, char **err_msg) {
+    struct stat st;
+    long long size = stat(local_file, &st) == 0 ? (long long)st.st_size : 0;
+    transport_kind kind = choose_transport(stats, size);
+    double started = monotonic_seconds();
+    int rc;
+
+    if (kind == TRANSPORT_SCP) {
+        rc = scp_upload_file(conn->session, conn->sftp_session, local_file, remote_file, err_msg);
+        if (rc == 2) {
+            fprintf(stderr, "DEBUG: Server refused SCP, using SFTP for all uploads\n");
+            pthread_mutex_lock(&stats->lock);
+            stats->scp_unavailable = true;
+            pthread_mutex_unlock(&stats->lock);
+        } else if (rc == 3) {
+            fprintf(stderr, "DEBUG: SCP rejected %s, retrying it over SFTP\n", remote_file);
+        }
+        if (rc == 2 || rc == 3) {
+            kind = TRANSPORT_SFTP;
+            started = monotonic_seconds();
+            rc = upload_file(conn->sftp_session, local_file, remote_file, transfer_write_bytes(conn), err_msg);
+        }
+    } else {
+        rc = upload_file(conn->sftp_session, local_file, remote_file, transfer_write_bytes(conn), err_msg);
+    }
+
+    if (rc == 0) {
+        record_transport_sample(stats, kind, size, monotonic_seconds() - started);
+    }
+    return rc;
+}
+
+// How long one blocking call of an operation may stall, scaled by what the
+// call can move (never more than the file) at the slower measured transport
+static long operation_stall_ms(transport_stats *stats, long long size, const transmit_connection *conn) {
+    double rate = 0;
+    pthread_mutex_lock(&stats->lock);
+    for (int kind = 0; kind < TRANSPORT_COUNT; kind++) {
+        if (stats->samples[kind] > 0 && (rate == 0 || stats->bytes_per_sec[kind] < rate)) {
+            rate = stats->bytes_per_sec[kind];
+        }
+    }
+    pthread_mutex_unlock(&stats->lock);
+    if (rate < OP_FLOOR_BYTES_PER_SEC) {
+        rate = OP_FLOOR_BYTES_PER_SEC;
+    }
+
+    long long call_bytes = (long long)transfer_call_bytes(conn);
+    if (size < call_bytes) {
+        call_bytes = size;
+    }
+    return OP_STALL_BASE_MS + (long)(OP_STALL_SLACK * 1000.0 * call_bytes / rate);
+}
+
+// Run one command, transparently reconnecting and retrying once if the
+// transport died or stalled underneath it. Without a standby, conn is an
+// extra worker's: a dead link is dropped and RESULT_LINK_LOST returned
+// instead, as reconnecting there would sidestep the pool's ramp.
+static int execute_command(transmit_connection *conn, transmit_standby *standby, transport_stats *stats, const char *command, const char *arg1, const char *arg2, char **err_msg) {
+    // Staged uploads land in a release made of hardlinks, so they replace
+    // the link instead of writing through it into the live release
+    bool stage = strcmp(command, "stage") == 0;
+    bool upload = stage || strcmp(command, "upload") == 0;
+    struct stat st;
+    long long size = upload && stat(arg1, &st) == 0 ? (long long)st.st_size : 0;
+    long stall_ms = operation_stall_ms(stats, size, conn);
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        int rc;
+        libssh2_session_set_timeout(conn->session, stall_ms);
+        if (stage) {
+            libssh2_sftp_unlink(conn->sftp_session, arg2);
+        }
+        if (upload) {
+            rc = upload_with_best_transport(conn, stats, arg1, arg2, err_msg);
+        } else {
+            rc = sftp_remove_path_recursive(conn->sftp_session, arg1, transfer_open_handles(conn), err_msg);
+        }
+        bool stalled = libssh2_session_last_errno(conn->session) == LIBSSH2_ERROR_TIMEOUT;
+        libssh2_session_set_timeout(conn->session, 0);
+
+        if (rc == 0 || attempt > 0 || !is_connection_error(conn->session)) {
+            if (rc != 0 && stalled) {
+                free(*err_msg);
+                asprintf(err_msg, "%s of '%s' stalled for over %ld s", upload ? "Upload" : "Remove",
+                         upload ? arg2 : arg1, stall_ms / 1000);
+            }
+            return rc;
+        }
+
+        if (stalled) {
+            fprintf(stderr, "DEBUG: %s stalled for %ld ms, retrying on a fresh session\n", command, stall_ms);
+        }
+
+        free(*err_msg);
+        *err_msg = NULL;
+        if (!standby) {
+            drop_session(conn);
+            return RESULT_LINK_LOST;
+        }
+        if (recover_session(conn, standby) != 0) {
+            asprintf(err_msg, "Connection lost during %s and reconnect failed", command);
+            return 1;
+        }
+    }
+    return 1;
+}
+
+// Finish the operations a previous helper accepted but never reported,
+// before taking new commands. Uploads whose local file is gone are skipped,
+// and so are staged files: their release was published or abandoned by now.
+// Anything cut short by a dead link stays journaled for the next start.
+// Returns how many entries were reported.
+static size_t replay_journal(transmit_connection *conn, transmit_standby *standby, transport_stats *stats, transmit_journal *journal) {
+    size_t count = journal->live_count;
+    if (count == 0) {
+        return 0;
+    }
+
+    // Completing an entry edits the live list, so walk a copy
+    journal_entry *pending = malloc(count * sizeof(*pending));
+    if (!pending) {
+        return 0;
+    }
+    memcpy(pending, journal->live, count * sizeof(*pending));
+
+    size_t reported = 0;
+    for (size_t i = 0; i < count; i++) {
+        journal_entry *entry = &pending[i];
+        bool stage = strcmp(entry->op, "stage") == 0;
+        bool upload = strcmp(entry->op, "upload") == 0;
+        char *err_msg = NULL;
+
+        reported++;
+        if (stage || (upload && access(entry->local, R_OK) != 0)) {
+            printf("REPLAY|skipped|%s|%s\n", entry->op, entry->remote);
+            journal_complete(journal, entry->seq);
+            continue;
+        }
+
+        int rc = execute_command(conn, standby, stats, upload ? "upload" : "remove",
+                                 upload ? entry->local : entry->remote, upload ? entry->remote : NULL, &err_msg);
+        if (rc == 0) {
+            printf("REPLAY|ok|%s|%s\n", entry->op, entry->remote);
+        } else {
+            printf("REPLAY|failed|%s|%s|%s\n", entry->op, entry->remote, err_msg ? err_msg : "unknown error");
+        }
+        fflush(stdout);
+        free(err_msg);
+
+        if (rc != 0 && (!conn->session || is_connection_error(conn->session))) {
+            break;
+        }
+        journal_complete(journal, entry->seq);
+    }
+
+    free(pending);
+    journal_sync(journal);
+    return reported;
+}
+
+// Milliseconds until the next keepalive probe or idle timeout is due
+static int idle_wait_ms(const transmit_connection *conn, const helper_options *opts, time_t last_activity, time_t last_verified) {
+    if (!conn->session) {
+        return -1;
+    }
+
+    time_t now = time(NULL);
+    time_t due = last_verified + opts->keepalive_interval;
+    if (opts->idle_timeout > 0 && last_activity + opts->idle_timeout < due) {
+        due = last_activity + opts->idle_timeout;
+    }
+    return due <= now ? 0 : (int)(due - now) * 1000;
+}
+
+// Prove the session still answers, replacing it if not. Returns 0 when usable.
+static int probe_session(transmit_connection *conn, transmit_standby *standby) {
+    int seconds_to_next = 0;
+    libssh2_session_set_timeout(conn->session, KEEPALIVE_PROBE_TIMEOUT_MS);
+    int alive = libssh2_keepalive_send(conn->session, &seconds_to_next) == 0 &&
+                is_sftp_session_alive(conn->sftp_session, conn->session);
+    libssh2_session_set_timeout(conn->session, 0);
+
+    return alive ? 0 : recover_session(conn, standby);
+}
+
+// Housekeeping while no command is pending: drop the session after a long
+// idle period, otherwise keep NAT state warm and prove the session still
+// answers so a dead link is replaced before the next save needs it
+static void idle_tick(transmit_connection *conn, transmit_standby *standby, const helper_options *opts, time_t last_activity, time_t *last_verified) {
+    time_t now = time(NULL);
+
+    if (!conn->session) {
+        return;
+    }
+
+    if (opts->idle_timeout > 0 && now - last_activity >= opts->idle_timeout) {
+        standby_stop(standby);
+        drop_session(conn);
+        printf("IDLE|disconnected\n");
+        fflush(stdout);
+        return;
+    }
+
+    if (now - *last_verified >= opts->keepalive_interval && probe_session(conn, standby) == 0) {
+        *last_verified = time(NULL);
+    }
+}
+
+// Bring back a session dropped by the idle policy or a failed recovery
+static int resume_session(transmit_connection *conn, transmit_standby *standby, const helper_options *opts) {
+    if (conn->session) {
+        return 0;
+    }
+
+    if (reconnect_session(conn) != 0) {
+        return -1;
+    }
+
+    if (opts->want_standby && !standby->running && standby_start(standby, conn) != 0) {
+        fprintf(stderr, "DEBUG: Failed to start standby session thread\n");
+    }
+    return 0;
+}
+
+// Split "name:/path" into its server name and path
+static int parse_server_spec(const char *spec, char *name, size_t name_size, const char **path) {
+    const char *colon = strchr(spec, ':');
+    if (!colon || colon == spec || (size_t)(colon - spec) >= name_size || colon[1] == '\0') {
+        return -1;
+    }
+    memcpy(name, spec, (size_t)(colon - spec));
+    name[colon - spec] = '\0';
+    *path = colon + 1;
+    return 0;
+}
+
+static defined_server *find_server_locked(transfer_pool *pool, const char *name) {
+    for (int i = 0; i < pool->server_count; i++) {
+        if (strcmp(pool->servers[i].name, name) == 0) {
+            return &pool->servers[i];
+        }
+    }
+    return NULL;
+}
+
+// Remember the credentials of another server for copies. Passwords would
+// have to be prompted for, so only key and agent authentication are taken.
+static int pool_define_server(transfer_pool *pool, const char *name, const char *account, const char *method, const char *key, const char **reason) {
+    const char *at = strrchr(account, '@');
+    if (!at || at == account || at[1] == '\0') {
+        *reason = "expected user@host";
+        return -1;
+    }
+    if (strcmp(method, "agent") != 0 && (strcmp(method, "key") != 0 || !*key)) {
+        *reason = "only key and agent authentication are supported";
+        return -1;
+    }
+
+    transmit_connection stale = { .sock = -1 };
+    pthread_mutex_lock(&pool->lock);
+    defined_server *server = find_server_locked(pool, name);
+    if (!server) {
+        if (pool->server_count == MAX_DEFINED_SERVERS) {
+            pthread_mutex_unlock(&pool->lock);
+            *reason = "too many servers defined";
+            return -1;
+        }
+        server = &pool->servers[pool->server_count++];
+    } else if (server->idle_ready) {
+        stale = server->idle;
+    }
+
+    memset(server, 0, sizeof(*server));
+    snprintf(server->name, sizeof(server->name), "%s", name);
+    snprintf(server->account.username, sizeof(server->account.username), "%.*s", (int)(at - account), account);
+    snprintf(server->account.hostname, sizeof(server->account.hostname), "%s", at + 1);
+    snprintf(server->account.auth_method, sizeof(server->account.auth_method), "%s", method);
+    snprintf(server->account.privkey_path, sizeof(server->account.privkey_path), "%s", key);
+    server->account.keepalive_interval = pool->opts->keepalive_interval;
+    server->account.sock = -1;
+    pthread_mutex_unlock(&pool->lock);
+
+    drop_session(&stale);
+    return 0;
+}
+
+// A session to a defined server: the one kept from the last copy if it still
+// answers, otherwise a new one. Returns -1 if the server isn't defined.
+static int server_connection_take(transfer_pool *pool, const char *name, transmit_connection *conn, char **err_msg) {
+    pthread_mutex_lock(&pool->lock);
+    defined_server *server = find_server_locked(pool, name);
+    if (!server) {
+        pthread_mutex_unlock(&pool->lock);
+        asprintf(err_msg, "Unknown server '%s'; define it first", name);
+        return -1;
+    }
+    bool reuse = server->idle_ready;
+    if (reuse) {
+        *conn = server->idle;
+        server->idle_ready = false;
+    }
+    transmit_connection account = server->account;
+    pthread_mutex_unlock(&pool->lock);
+
+    if (reuse) {
+        if (is_sftp_session_alive(conn->sftp_session, conn->session)) {
+            return 0;
+        }
+        drop_session(conn);
+    }
+    connection_template(&account, conn);
+    if (connect_session(conn) != 0) {
+        asprintf(err_msg, "Failed to connect to server '%s'", name);
+        return -1;
+    }
+    return 0;
+}
+
+// Keep a healthy session for the next copy to that server, or close it
+static void server_connection_give(transfer_pool *pool, const char *name, transmit_connection *conn) {
+    if (conn->session && !is_connection_error(conn->session)) {
+        libssh2_session_set_timeout(conn->session, 0);
+        pthread_mutex_lock(&pool->lock);
+        defined_server *server = find_server_locked(pool, name);
+        bool kept = server && !server->idle_ready && !pool->stop;
+        if (kept) {
+            server->idle = *conn;
+            server->idle_ready = true;
+        }
+        pthread_mutex_unlock(&pool->lock);
+        if (kept) {
+            return;
+        }
+    }
+    drop_session(conn);
+}
+
+// Stream a file or tree from one defined server to another, retrying once
+// on fresh sessions if either link died or stalled
+static int copy_between_servers(transfer_pool *pool, const char *from_spec, const char *to_spec, unsigned long long *copied, char **err_msg) {
+    char from_name[64], to_name[64];
+    const char *from_path, *to_path;
+    if (parse_server_spec(from_spec, from_name, sizeof(from_name), &from_path) != 0 ||
+        parse_server_spec(to_spec, to_name, sizeof(to_name), &to_path) != 0) {
+        asprintf(err_msg, "Expected <server>:<path> for both ends of a copy");
+        return 1;
+    }
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        transmit_connection from = { .sock = -1 };
+        transmit_connection to = { .sock = -1 };
+        if (server_connection_take(pool, from_name, &from, err_msg) != 0) {
+            return 1;
+        }
+        if (server_connection_take(pool, to_name, &to, err_msg) != 0) {
+            server_connection_give(pool, from_name, &from);
+            return 1;
+        }
+
+        // Writes are sized for the destination, which was never probed
+        long stall_ms = operation_stall_ms(pool->transports, (long long)transfer_call_bytes(&to), &to);
+        libssh2_session_set_timeout(from.session, stall_ms);
+        libssh2_session_set_timeout(to.session, stall_ms);
+        int rc = sftp_copy_path(from.sftp_session, to.sftp_session, from_path, to_path,
+                                transfer_write_bytes(&to), copied, err_msg);
+        bool link_failed = is_connection_error(from.session) || is_connection_error(to.session);
+
+        server_connection_give(pool, from_name, &from);
+        server_connection_give(pool, to_name, &to);
+        if (rc == 0 || attempt > 0 || !link_failed) {
+            return rc;
+        }
+        free(*err_msg);
+        *err_msg = NULL;
+    }
+    return 1;
+}
+
+// One step of a release, on conn. Steps are barriers, so no transfer into
+// the staging directory runs alongside them.
+static int run_release_step(transfer_pool *pool, transmit_connection *conn, const transfer_job *job, char **err_msg) {
+    const char *dir = job->arg1;
+    const char *live = job->arg2;
+    int rc;
+
+    if (strcmp(job->command, "release-begin") == 0) {
+        pthread_mutex_lock(&pool->lock);
+        pool->release_faults = 0;
+        pthread_mutex_unlock(&pool->lock);
+        rc = release_stage(conn, pool->caps, live, dir, err_msg);
+        if (rc == 0) {
+            printf("RELEASE|staged|%s|%s\n", live, dir);
+        }
+    } else if (strcmp(job->command, "release-commit") == 0) {
+        pthread_mutex_lock(&pool->lock);
+        int faults = pool->release_faults;
+        pthread_mutex_unlock(&pool->lock);
+        if (faults > 0) {
+            asprintf(err_msg, "Release %s not published: %d of its steps failed", dir, faults);
+            return 1;
+        }
+        rc = release_publish(conn, pool->caps, live, dir, err_msg);
+        if (rc == 0) {
+            printf("RELEASE|live|%s|%s\n", live, dir);
+        }
+    } else {
+        rc = sftp_remove_path_recursive(conn->sftp_session, dir, transfer_open_handles(conn), err_msg);
+        dir_cache_forget(dir);
+        if (rc == 0) {
+            printf("RELEASE|aborted|%s|%s\n", live, dir);
+        }
+    }
+    fflush(stdout);
+    return rc;
+}
+
+static bool job_is_barrier(const transfer_job *job) {
+    return strcmp(job->command, "remove") == 0 || strncmp(job->command, "release-", 8) == 0;
+}
+
+// Whether job must wait for an earlier unfinished one. Removes and release
+// steps are barriers in both directions; uploads only wait for earlier work
+// on the same path.
+static bool job_blocked_locked(const transfer_pool *pool, const transfer_job *job) {
+    bool barrier = job_is_barrier(job);
+    for (const transfer_job *earlier = pool->head; earlier != job; earlier = earlier->next) {
+        if (earlier->done || !earlier->valid) {
+            continue;
+        }
+        if (barrier || job_is_barrier(earlier) || strcmp(earlier->remote, job->remote) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static double job_cost(const transfer_job *job) {
+    return (double)job->size + FILE_OVERHEAD_BYTES;
+}
+
+// Shortest job first within a flow (any flow if negative): the cheapest
+// runnable job, unless an older one has been overtaken often enough to be
+// owed its turn
+static transfer_job *next_runnable_job_locked(const transfer_pool *pool, int flow) {
+    transfer_job *best = NULL;
+    for (transfer_job *job = pool->head; job; job = job->next) {
+        if (!job->valid || job->started || (flow >= 0 && job->flow != flow) || job_blocked_locked(pool, job)) {
+            continue;
+        }
+        if (job->bypassed >= SJF_MAX_BYPASS) {
+            return job;
+        }
+        if (!best || job_cost(job) < job_cost(best)) {
+            best = job;
+        }
+    }
+    return best;
+}
+
+// Print finished results from the head of the queue, stopping at the first
+// job still running so frontends see them in the order they were sent
+static void report_completed_locked(transfer_pool *pool) {
+    bool printed = false;
+    while (pool->head && pool->head->done) {
+        transfer_job *job = pool->head;
+        const char *label = strcmp(job->command, "upload") == 0 || strcmp(job->command, "stage") == 0 ? "Upload"
+            : strcmp(job->command, "copy") == 0 ? "Copy"
+            : strncmp(job->command, "release-", 8) == 0 ? "Release" : "Remove";
+
+        if (!job->valid) {
+            printf("0|%s\n", job->err_msg ? job->err_msg : "Unknown command or incorrect usage");
+        } else if (job->rc == 0) {
+            printf("1|%s succeeded\n", label);
+        } else if (job->err_msg) {
+            printf("0|%s\n", job->err_msg);
+        } else {
+            printf("0|%s failed\n", label);
+        }
+        printf("CREDIT|1\n");
+        printed = true;
+
+        // A job lost with the session stays journaled for the next helper
+        if (!job->lost) {
+            journal_complete(pool->journal, job->seq);
+        }
+
+        pool->head = job->next;
+        if (!pool->head) {
+            pool->tail = NULL;
+        }
+        pool->outstanding--;
+        pool->flows[job->flow].jobs--;
+        free(job->err_msg);
+        free(job);
+    }
+    if (printed) {
+        fflush(stdout);
+    }
+}
+
+static void *extra_worker_main(void *arg);
+
+// Start one more connection. Returns 0 if a worker thread was started.
+static int spawn_worker_locked(transfer_pool *pool) {
+    transfer_worker *slot = NULL;
+    for (int i = 1; i < MAX_TRANSFER_CONNECTIONS; i++) {
+        if (!pool->slots[i].in_use) {
+            slot = &pool->slots[i];
+            break;
+        }
+    }
+    if (!slot) {
+        return -1;
+    }
+
+    slot->pool = pool;
+    slot->in_use = true;
+    connection_template(pool->primary, &slot->conn);
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int rc = pthread_create(&thread, &attr, extra_worker_main, slot);
+    pthread_attr_destroy(&attr);
+    if (rc != 0) {
+        slot->in_use = false;
+        return -1;
+    }
+
+    pool->workers++;
+    pool->threads++;
+    pool->connecting++;
+    return 0;
+}
+
+// The oldest save that has waited past the latency bound and could run now
+static transfer_job *overdue_save_locked(const transfer_pool *pool, double now) {
+    if (pool->opts->save_latency <= 0) {
+        return NULL;
+    }
+    for (transfer_job *job = pool->head; job; job = job->next) {
+        if (job->valid && !job->started && pool->flows[job->flow].save &&
+            now - job->queued_at >= pool->opts->save_latency && !job_blocked_locked(pool, job)) {
+            return job;
+        }
+    }
+    return NULL;
+}
+
+// Add connections while a backlog exists. With a known ceiling the pool
+// opens what the backlog can use at once; otherwise, and beyond a ceiling
+// only remembered from an earlier run, it adds one connection per
+// measurement window and stops where aggregate throughput levels off.
+static void pool_ramp_locked(transfer_pool *pool) {
+    if (pool->stop || pool->fatal) {
+        return;
+    }
+
+    if (pool->queued == 0) {
+        if (pool->running == 0) {
+            pool->window_workers = 0;
+            pool->best_rate = 0;
+            // Drop connections added past the ceiling for overdue saves
+            pool->target = pool->ceiling > 0 ? pool->ceiling : MAX_TRANSFER_CONNECTIONS;
+        }
+        return;
+    }
+
+    if (monotonic_seconds() < pool->connect_retry_at) {
+        return;
+    }
+
+    // Every worker is busy and a save is past its latency bound: give it a
+    // connection of its own, even beyond the learned ceiling
+    if (pool->workers - pool->running <= 0 && pool->workers < MAX_TRANSFER_CONNECTIONS &&
+        overdue_save_locked(pool, monotonic_seconds())) {
+        if (pool->target <= pool->workers) {
+            pool->target = pool->workers + 1;
+        }
+        spawn_worker_locked(pool);
+        return;
+    }
+
+    if (pool->ceiling > 0) {
+        while (pool->workers < pool->target &&
+               pool->workers - pool->running < pool->queued &&
+               spawn_worker_locked(pool) == 0) {
+        }
+        // A ceiling from an earlier run is only where to start measuring
+        if (pool->ceiling_settled || pool->workers < pool->ceiling) {
+            return;
+        }
+    }
+
+    // Only a saturated pool says anything about the next connection
+    if (pool->running + pool->connecting < pool->workers || !next_runnable_job_locked(pool, -1)) {
+        return;
+    }
+
+    double now = monotonic_seconds();
+    if (pool->window_workers != pool->workers) {
+        pool->window_workers = pool->workers;
+        pool->window_start = now;
+        pool->window_cost = 0;
+        pool->window_jobs = 0;
+        return;
+    }
+
+    double elapsed = now - pool->window_start;
+    if (elapsed < RAMP_WINDOW_SECONDS || pool->window_jobs == 0) {
+        return;
+    }
+
+    double rate = pool->window_cost / elapsed;
+    if (pool->best_rate > 0 && rate < pool->best_rate * RAMP_MIN_GAIN) {
+        // The newest connection didn't pay for itself; retire it
+        pool->ceiling = pool->target = pool->workers - 1;
+        pool->ceiling_settled = true;
+        fprintf(stderr, "DEBUG: Throughput levelled off at %d connections\n", pool->ceiling);
+        return;
+    }
+
+    pool->best_rate = rate;
+    if (pool->workers >= MAX_TRANSFER_CONNECTIONS) {
+        pool->ceiling = pool->target = pool->workers;
+        pool->ceiling_settled = true;
+        return;
+    }
+    if (pool->target <= pool->workers) {
+        pool->target = pool->workers + 1;
+    }
+    spawn_worker_locked(pool);
+}
+
+static bool path_under(const char *path, const char *root) {
+    size_t len = strlen(root);
+    return strncmp(path, root, len) == 0 && (path[len] == '/' || path[len] == '\0');
+}
+
+// A finished transfer under a hook's root schedules the hook. Staged files
+// aren't live yet; their release's commit schedules it instead.
+static void hook_note_locked(transfer_pool *pool, const transfer_job *job) {
+    if (job->rc != 0 || job->staged ||
+        (strcmp(job->command, "upload") != 0 && strcmp(job->command, "remove") != 0 &&
+         strcmp(job->command, "release-commit") != 0)) {
+        return;
+    }
+    for (int i = 0; i < pool->hook_count; i++) {
+        if (path_under(job->remote, pool->hooks[i].root)) {
+            pool->hooks[i].dirty = true;
+            pool->hooks[i].changed_at = monotonic_seconds();
+        }
+    }
+}
+
+// Whether a transfer under the hook's root is still queued or running, so
+// the batch it belongs to isn't over
+static bool hook_busy_locked(const transfer_pool *pool, const remote_hook *hook) {
+    for (const transfer_job *job = pool->head; job; job = job->next) {
+        if (job->valid && !job->done && path_under(job->remote, hook->root)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void finish_job_locked(transfer_pool *pool, transfer_job *job, int rc, char *err_msg) {
+    job->done = true;
+    job->rc = rc;
+    job->err_msg = err_msg;
+    pool->running--;
+    pool->last_activity = time(NULL);
+    if (strcmp(job->command, "remove") == 0) {
+        dir_cache_forget(job->remote);
+    }
+    // A release missing any of its changes must not go live
+    if (rc != 0 && (job->staged || strcmp(job->command, "release-begin") == 0)) {
+        pool->release_faults++;
+    }
+    hook_note_locked(pool, job);
+
+    if (pool->window_workers == pool->workers) {
+        pool->window_cost += job_cost(job);
+        pool->window_jobs++;
+    }
+
+    report_completed_locked(pool);
+    pool_ramp_locked(pool);
+    // Finishing may unblock jobs queued behind this one
+    pthread_cond_broadcast(&pool->work);
+    pthread_cond_broadcast(&pool->changed);
+}
+
+static double flow_quantum(const transfer_flow *flow) {
+    return flow->save ? (double)DRR_QUANTUM_BYTES * SAVE_FLOW_WEIGHT : DRR_QUANTUM_BYTES;
+}
+
+static void start_job_locked(transfer_pool *pool, transfer_job *job) {
+    for (transfer_job *earlier = pool->head; earlier != job; earlier = earlier->next) {
+        if (earlier->valid && !earlier->started && earlier->flow == job->flow) {
+            earlier->bypassed++;
+        }
+    }
+    job->started = true;
+    pool->queued--;
+    pool->running++;
+}
+
+// Put a job whose connection died back in line, in its original place
+static void requeue_job_locked(transfer_pool *pool, transfer_job *job) {
+    job->started = false;
+    pool->queued++;
+    pool->running--;
+    pthread_cond_broadcast(&pool->work);
+}
+
+// Pick the next job by deficit round robin over the flows. A flow keeps the
+// workers while its deficit covers its next job; when no flow can afford
+// one, every waiting flow is credited the rounds the closest one needs in a
+// single step, so a 500 MB job doesn't take thousands of empty rounds.
+static transfer_job *take_job_locked(transfer_pool *pool) {
+    transfer_job *overdue = overdue_save_locked(pool, monotonic_seconds());
+    if (overdue) {
+        start_job_locked(pool, overdue);
+        return overdue;
+    }
+
+    transfer_job *candidates[MAX_FLOWS];
+    bool any = false;
+    for (int i = 0; i < MAX_FLOWS; i++) {
+        candidates[i] = pool->flows[i].jobs > 0 ? next_runnable_job_locked(pool, i) : NULL;
+        if (!candidates[i]) {
+            pool->flows[i].deficit = 0;
+        }
+        any = any || candidates[i];
+    }
+    if (!any) {
+        return NULL;
+    }
+
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < MAX_FLOWS; i++) {
+            int index = (pool->flow_cursor + i) % MAX_FLOWS;
+            transfer_job *job = candidates[index];
+            if (job && pool->flows[index].deficit >= job_cost(job)) {
+                pool->flows[index].deficit -= job_cost(job);
+                pool->flow_cursor = index;
+                start_job_locked(pool, job);
+                return job;
+            }
+        }
+
+        double rounds = 0;
+        for (int i = 0; i < MAX_FLOWS; i++) {
+            if (candidates[i]) {
+                transfer_flow *flow = &pool->flows[i];
+                double shortfall = (job_cost(candidates[i]) - flow->deficit) / flow_quantum(flow);
+                double needed = (double)(long long)shortfall < shortfall ? (double)(long long)shortfall + 1 : (double)(long long)shortfall;
+                if (rounds == 0 || needed < rounds) {
+                    rounds = needed;
+                }
+            }
+        }
+        for (int i = 0; i < MAX_FLOWS; i++) {
+            if (candidates[i]) {
+                pool->flows[i].deficit += rounds * flow_quantum(&pool->flows[i]);
+            }
+        }
+        pool->flow_cursor = (pool->flow_cursor + 1) % MAX_FLOWS;
+    }
+    return NULL;
+}
+
+static void pool_wake_main(transfer_pool *pool) {
+    char byte = 1;
+    if (write(pool->wake_fd[1], &byte, 1) < 0) {
+        fprintf(stderr, "DEBUG: Failed to wake command loop\n");
+    }
+}
+
+// Worker 0: transfers on the primary connection, which also carries the
+// standby failover, idle policy and prewarm requests
+static void *primary_worker_main(void *arg) {
+    transfer_pool *pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        transfer_job *job = NULL;
+        while (!pool->stop && !pool->fatal && !(job = take_job_locked(pool))) {
+            pthread_cond_wait(&pool->work, &pool->lock);
+        }
+        if (!job) {
+            break;
+        }
+        bool verify = time(NULL) - pool->last_verified >= pool->opts->keepalive_interval;
+        pthread_mutex_unlock(&pool->lock);
+
+        transmit_connection *conn = pool->primary;
+        char *err_msg = NULL;
+        int rc;
+        bool lost = false;
+
+        // Copies run on sessions of their own
+        if (strcmp(job->command, "copy") == 0) {
+            unsigned long long copied = 0;
+            rc = copy_between_servers(pool, job->arg1, job->arg2, &copied, &err_msg);
+            pthread_mutex_lock(&pool->lock);
+            job->size = (long long)copied;
+            finish_job_locked(pool, job, rc, err_msg);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->primary_lock);
+        // Only prove liveness up front if keepalives haven't done so recently
+        if (resume_session(conn, pool->standby, pool->opts) != 0 ||
+            (verify && !is_sftp_session_alive(conn->sftp_session, conn->session) &&
+             recover_session(conn, pool->standby) != 0)) {
+            lost = true;
+            rc = 1;
+            err_msg = strdup("SFTP session lost");
+        } else if (strncmp(job->command, "release-", 8) == 0) {
+            rc = run_release_step(pool, conn, job, &err_msg);
+        } else {
+            rc = execute_command(conn, pool->standby, pool->transports, job->command, job->arg1, job->arg2, &err_msg);
+        }
+        bool healthy = conn->session && !is_connection_error(conn->session);
+        pthread_mutex_unlock(&pool->primary_lock);
+
+        pthread_mutex_lock(&pool->lock);
+        if (healthy) {
+            pool->last_verified = time(NULL);
+        }
+        if (lost) {
+            job->lost = true;
+            pool->fatal = true;
+            pool_wake_main(pool);
+        }
+        finish_job_locked(pool, job, rc, err_msg);
+    }
+    pool->threads--;
+    pool->workers--;
+    pthread_cond_broadcast(&pool->changed);
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+// Extra workers: connect on their own thread, so several handshakes overlap,
+// then take jobs until idle for WORKER_IDLE_SECONDS or no longer wanted
+static void *extra_worker_main(void *arg) {
+    transfer_worker *slot = arg;
+    transfer_pool *pool = slot->pool;
+    int rc = connect_session(&slot->conn);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->connecting--;
+    if (rc == SESSION_REFUSED) {
+        // The server turned the session down: that is its limit
+        pool->workers--;
+        pool->ceiling_settled = true;
+        if (pool->ceiling == 0 || pool->ceiling > pool->workers) {
+            pool->ceiling = pool->target = pool->workers;
+            pool->ceiling_changed = true;
+        }
+        fprintf(stderr, "DEBUG: Extra connection refused, keeping %d\n", pool->workers);
+    } else if (rc != 0) {
+        // Unreachable or timed out, which says nothing about the server's
+        // limit: back off, then measure the current count afresh
+        pool->workers--;
+        pool->connect_retry_at = monotonic_seconds() + CONNECT_RETRY_SECONDS;
+        pool->window_workers = 0;
+        pool->best_rate = 0;
+        fprintf(stderr, "DEBUG: Extra connection failed, retrying later\n");
+    }
+
+    while (rc == 0) {
+        transfer_job *job = NULL;
+        while (!pool->stop && pool->workers <= pool->target && !(job = take_job_locked(pool))) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += WORKER_IDLE_SECONDS;
+            if (pthread_cond_timedwait(&pool->work, &pool->lock, &deadline) == ETIMEDOUT &&
+                !(job = take_job_locked(pool))) {
+                break;
+            }
+        }
+        if (!job) {
+            break;
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        char *err_msg = NULL;
+        int result;
+        unsigned long long copied = 0;
+        if (strcmp(job->command, "copy") == 0) {
+            result = copy_between_servers(pool, job->arg1, job->arg2, &copied, &err_msg);
+        } else if (strncmp(job->command, "release-", 8) == 0) {
+            result = run_release_step(pool, &slot->conn, job, &err_msg);
+        } else {
+            result = execute_command(&slot->conn, NULL, pool->transports, job->command, job->arg1, job->arg2, &err_msg);
+        }
+        bool healthy = slot->conn.session != NULL;
+
+        pthread_mutex_lock(&pool->lock);
+        if (result == RESULT_LINK_LOST) {
+            // Another connection runs it; replacing this one waits as after
+            // a failed connect, since the server may be shedding connections
+            requeue_job_locked(pool, job);
+            pool->connect_retry_at = monotonic_seconds() + CONNECT_RETRY_SECONDS;
+            pool->window_workers = 0;
+            pool->best_rate = 0;
+            fprintf(stderr, "DEBUG: Extra connection dropped, requeued %s\n", job->command);
+            break;
+        }
+        if (copied > 0) {
+            job->size = (long long)copied;
+        }
+        finish_job_locked(pool, job, result, err_msg);
+        if (!healthy) {
+            break;
+        }
+    }
+    if (rc == 0) {
+        pool->workers--;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    drop_session(&slot->conn);
+
+    pthread_mutex_lock(&pool->lock);
+    slot->in_use = false;
+    pool->threads--;
+    // The backlog may still need a connection this worker was holding
+    pool_ramp_locked(pool);
+    pthread_cond_broadcast(&pool->changed);
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+static int pool_start(transfer_pool *pool, transmit_connection *primary, transmit_standby *standby,
+                      transport_stats *transports, transmit_journal *journal, const helper_options *opts,
+                      const server_capabilities *caps) {
+    unsigned ceiling = caps->max_connections;
+    if (pipe(pool->wake_fd) != 0) {
+        return -1;
+    }
+    fcntl(pool->wake_fd[0], F_SETFL, O_NONBLOCK);
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_mutex_init(&pool->primary_lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->changed, NULL);
+    pool->primary = primary;
+    pool->standby = standby;
+    pool->transports = transports;
+    pool->journal = journal;
+    pool->opts = opts;
+    pool->caps = caps;
+    pool->ceiling = ceiling > MAX_TRANSFER_CONNECTIONS ? MAX_TRANSFER_CONNECTIONS : (int)ceiling;
+    pool->target = pool->ceiling > 0 ? pool->ceiling : MAX_TRANSFER_CONNECTIONS;
+    pool->last_activity = pool->last_verified = time(NULL);
+    pool->slots[0].pool = pool;
+    pool->slots[0].in_use = true;
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int rc = pthread_create(&thread, &attr, primary_worker_main, pool);
+    pthread_attr_destroy(&attr);
+    if (rc != 0) {
+        return -1;
+    }
+    pool->workers = 1;
+    pool->threads = 1;
+    return 0;
+}
+
+// Run one hook on a session of its own and report its exit status, time
+// and output. Runs come once per batch, so a handshake each time costs less
+// than holding another connection open between them.
+static void run_hook(transfer_pool *pool, const char *root, const char *command) {
+    transmit_connection conn;
+    connection_template(pool->primary, &conn);
+    char output[512] = "";
+    double started = monotonic_seconds();
+    int status = -1;
+
+    if (connect_session(&conn) != 0) {
+        snprintf(output, sizeof(output), "failed to connect");
+    } else {
+        libssh2_session_set_timeout(conn.session, HOOK_TIMEOUT_MS);
+        status = run_remote_hook(conn.session, command, output, sizeof(output));
+        if (libssh2_session_last_errno(conn.session) == LIBSSH2_ERROR_TIMEOUT) {
+            status = -1;
+            snprintf(output, sizeof(output), "timed out after %d s", HOOK_TIMEOUT_MS / 1000);
+        } else if (status < 0 && !output[0]) {
+            snprintf(output, sizeof(output), "exec refused");
+        }
+        drop_session(&conn);
+    }
+
+    printf("HOOK|%s|ran|%d|%ld|%s\n", root, status, (long)((monotonic_seconds() - started) * 1000), output);
+    fflush(stdout);
+}
+
+// Run each dirty hook once nothing under its root is queued or running and
+// its quiet period has passed. Hooks still dirty at exit run right away,
+// unless the helper is exiting because the server went away.
+static void *hook_main(void *arg) {
+    transfer_pool *pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    while (!(pool->stop && pool->fatal)) {
+        double now = monotonic_seconds();
+        double wait = -1;
+        remote_hook *due = NULL;
+        for (int i = 0; i < pool->hook_count && !due; i++) {
+            remote_hook *hook = &pool->hooks[i];
+            if (!hook->dirty || hook_busy_locked(pool, hook)) {
+                continue;
+            }
+            double left = hook->changed_at + hook->quiet_ms / 1000.0 - now;
+            if (left <= 0 || pool->stop) {
+                due = hook;
+            } else if (wait < 0 || left < wait) {
+                wait = left;
+            }
+        }
+
+        if (!due) {
+            if (pool->stop) {
+                break;
+            }
+            if (wait < 0) {
+                pthread_cond_wait(&pool->changed, &pool->lock);
+            } else {
+                struct timespec deadline;
+                clock_gettime(CLOCK_REALTIME, &deadline);
+                long long nanos = deadline.tv_nsec + (long long)(wait * 1e9);
+                deadline.tv_sec += (time_t)(nanos / 1000000000LL);
+                deadline.tv_nsec = (long)(nanos % 1000000000LL);
+                pthread_cond_timedwait(&pool->changed, &pool->lock, &deadline);
+            }
+            continue;
+        }
+
+        char root[sizeof(due->root)], command[sizeof(due->command)];
+        snprintf(root, sizeof(root), "%s", due->root);
+        snprintf(command, sizeof(command), "%s", due->command);
+        due->dirty = false;
+        pthread_mutex_unlock(&pool->lock);
+        run_hook(pool, root, command);
+        pthread_mutex_lock(&pool->lock);
+    }
+    pool->hook_thread = false;
+    pthread_cond_broadcast(&pool->changed);
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+// Register, replace or (with an empty command) drop the hook of a remote
+// root, starting the hook runner on first use
+static int pool_set_hook(transfer_pool *pool, const char *path, int quiet_ms, const char *command, const char **reason) {
+    char root[256];
+    snprintf(root, sizeof(root), "%s", path);
+    size_t len = strlen(root);
+    while (len > 1 && root[len - 1] == '/') {
+        root[--len] = '\0';
+    }
+    if (strlen(command) >= sizeof(pool->hooks[0].command)) {
+        *reason = "command too long";
+        return -1;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    remote_hook *hook = NULL;
+    for (int i = 0; i < pool->hook_count; i++) {
+        if (strcmp(pool->hooks[i].root, root) == 0) {
+            hook = &pool->hooks[i];
+        }
+    }
+    if (!*command) {
+        if (hook) {
+            *hook = pool->hooks[--pool->hook_count];
+        }
+        pthread_mutex_unlock(&pool->lock);
+        return 0;
+    }
+    if (!hook) {
+        if (pool->hook_count == MAX_HOOKS) {
+            pthread_mutex_unlock(&pool->lock);
+            *reason = "too many hooks";
+            return -1;
+        }
+        hook = &pool->hooks[pool->hook_count++];
+        memset(hook, 0, sizeof(*hook));
+        snprintf(hook->root, sizeof(hook->root), "%s", root);
+    }
+    snprintf(hook->command, sizeof(hook->command), "%s", command);
+    hook->quiet_ms = quiet_ms > 0 ? quiet_ms : 0;
+
+    int rc = 0;
+    if (!pool->hook_thread) {
+        pthread_t thread;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        if (pthread_create(&thread, &attr, hook_main, pool) == 0) {
+            pool->hook_thread = true;
+        } else {
+            pool->hook_count--;
+            *reason = "failed to start the hook runner";
+            rc = -1;
+        }
+        pthread_attr_destroy(&attr);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return rc;
+}
+
+// Flow slot for a command's tag, reusing a slot whose jobs have all been
+// reported. Untagged jobs, and tags beyond MAX_FLOWS, share flow 0.
+static int flow_for_tag_locked(transfer_pool *pool, const char *tag) {
+    if (!tag || !*tag) {
+        return 0;
+    }
+
+    int free_slot = -1;
+    for (int i = 1; i < MAX_FLOWS; i++) {
+        if (pool->flows[i].jobs > 0 && strcmp(pool->flows[i].name, tag) == 0) {
+            return i;
+        }
+        if (free_slot < 0 && pool->flows[i].jobs == 0) {
+            free_slot = i;
+        }
+    }
+    if (free_slot < 0) {
+        return 0;
+    }
+
+    transfer_flow *flow = &pool->flows[free_slot];
+    snprintf(flow->name, sizeof(flow->name), "%s", tag);
+    flow->save = strncmp(tag, "save:", 5) == 0;
+    flow->deficit = 0;
+    return free_slot;
+}
+
+// Open, commit or abort the release of a live symlink. The staging
+// directory is named on submission, so commands sent right after "begin"
+// are redirected into it before the step itself has run.
+static void release_submit_locked(transfer_pool *pool, transfer_job *job, const char *action, const char *path) {
+    char live[256];
+    snprintf(live, sizeof(live), "%s", path);
+    size_t len = strlen(live);
+    while (len > 1 && live[len - 1] == '/') {
+        live[--len] = '\0';
+    }
+    const char *slash = strrchr(live, '/');
+    bool begin = strcmp(action, "begin") == 0;
+    const char *problem = NULL;
+
+    if (!begin && strcmp(action, "commit") != 0 && strcmp(action, "abort") != 0) {
+        problem = "usage: release <begin|commit|abort> <live path>";
+    } else if (live[0] != '/' || slash == live || len > 200) {
+        problem = "A release needs an absolute live path below the root, e.g. /srv/app/current";
+    } else if (begin && pool->release_open) {
+        problem = "A release is already being staged; commit or abort it first";
+    } else if (!begin && (!pool->release_open || strcmp(pool->release_live, live) != 0)) {
+        problem = "No release is being staged for that path";
+    }
+    if (problem) {
+        job->err_msg = strdup(problem);
+        job->done = true;
+        return;
+    }
+
+    if (begin) {
+        char stamp[32], dir[256];
+        time_t now = time(NULL);
+        struct tm tm;
+        gmtime_r(&now, &tm);
+        strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+        snprintf(dir, sizeof(dir), "%.*s/releases/%s", (int)(slash - live), live, stamp);
+        // Two releases within a second must not share a directory
+        if (strncmp(dir, pool->release_dir, strlen(dir)) == 0) {
+            snprintf(dir, sizeof(dir), "%.*s/releases/%s-%u", (int)(slash - live), live, stamp,
+                     pool->release_serial);
+        }
+        pool->release_serial++;
+        snprintf(pool->release_dir, sizeof(pool->release_dir), "%s", dir);
+        snprintf(pool->release_live, sizeof(pool->release_live), "%s", live);
+    }
+    pool->release_open = begin;
+
+    snprintf(job->command, sizeof(job->command), "release-%s", action);
+    snprintf(job->arg1, sizeof(job->arg1), "%s", pool->release_dir);
+    snprintf(job->arg2, sizeof(job->arg2), "%s", live);
+    job->remote = job->arg2;
+    job->valid = true;
+}
+
+// Redirect an upload or remove below the live path of the open release into
+// its staging directory
+static void stage_job_locked(transfer_pool *pool, transfer_job *job) {
+    size_t len = strlen(pool->release_live);
+    if (!pool->release_open || strncmp(job->remote, pool->release_live, len) != 0 || job->remote[len] != '/') {
+        return;
+    }
+
+    char staged[256];
+    if (snprintf(staged, sizeof(staged), "%s%s", pool->release_dir, job->remote + len) >= (int)sizeof(staged)) {
+        job->err_msg = strdup("Remote path too long for the release directory");
+        job->valid = false;
+        job->done = true;
+        return;
+    }
+    char *remote = job->remote == job->arg1 ? job->arg1 : job->arg2;
+    snprintf(remote, sizeof(job->arg1), "%s", staged);
+    if (strcmp(job->command, "upload") == 0) {
+        snprintf(job->command, sizeof(job->command), "stage");
+    }
+    job->staged = true;
+}
+
+// Queue one parsed command. Usage errors are queued too, so their result
+// keeps its place in the output order.
+static void pool_submit(transfer_pool *pool, const char *command, const char *arg1, const char *arg2, const char *arg3, int num) {
+    transfer_job *job = calloc(1, sizeof(*job));
+    if (!job) {
+        printf("0|Out of memory\n");
+        printf("CREDIT|1\n");
+        fflush(stdout);
+        return;
+    }
+
+    snprintf(job->command, sizeof(job->command), "%s", command);
+    snprintf(job->arg1, sizeof(job->arg1), "%s", arg1);
+    const char *tag = NULL;
+    if (strcmp(command, "upload") == 0 && (num == 3 || num == 4)) {
+        struct stat st;
+        snprintf(job->arg2, sizeof(job->arg2), "%s", arg2);
+        job->valid = true;
+        job->remote = job->arg2;
+        job->size = stat(arg1, &st) == 0 ? (long long)st.st_size : 0;
+        tag = num == 4 ? arg3 : NULL;
+    } else if (strcmp(command, "remove") == 0 && (num == 2 || num == 3)) {
+        job->valid = true;
+        job->remote = job->arg1;
+        tag = num == 3 ? arg2 : NULL;
+    } else if (strcmp(command, "copy") == 0 && (num == 3 || num == 4)) {
+        // Remote to remote: both arguments are <server>:<path>
+        snprintf(job->arg2, sizeof(job->arg2), "%s", arg2);
+        job->valid = true;
+        job->remote = job->arg2;
+        tag = num == 4 ? arg3 : NULL;
+    } else if (strcmp(command, "release") == 0 && (num == 3 || num == 4)) {
+        tag = num == 4 ? arg3 : NULL;
+    } else {
+        job->done = true;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    if (strcmp(command, "release") == 0 && !job->done) {
+        release_submit_locked(pool, job, arg1, arg2);
+    } else if (job->valid && strcmp(command, "copy") != 0) {
+        stage_job_locked(pool, job);
+    }
+    // Journal before touching the session, so an operation cut short by a
+    // dead link or a killed helper is resumed by the next one
+    if (job->valid) {
+        bool upload = strcmp(job->command, "upload") == 0 || strcmp(job->command, "stage") == 0;
+        // Copies and release steps aren't journaled; they are simply sent again
+        if (strcmp(command, "copy") != 0 && strcmp(command, "release") != 0) {
+            job->seq = journal_accept(pool->journal, job->command, upload ? job->arg1 : "", job->remote);
+        }
+        pool->queued++;
+    }
+    job->flow = flow_for_tag_locked(pool, tag);
+    job->queued_at = monotonic_seconds();
+    pool->flows[job->flow].jobs++;
+    pool->last_activity = time(NULL);
+    if (pool->tail) {
+        pool->tail->next = job;
+    } else {
+        pool->head = job;
+    }
+    pool->tail = job;
+    pool->outstanding++;
+
+    report_completed_locked(pool);
+    pool_ramp_locked(pool);
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Wait for every worker to exit; unless the session was lost, queued jobs
+// are finished first
+static void pool_stop(transfer_pool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->outstanding > 0 && !pool->fatal && pool->threads > 0) {
+        pthread_cond_wait(&pool->changed, &pool->lock);
+    }
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->work);
+    while (pool->threads > 0) {
+        pthread_cond_wait(&pool->changed, &pool->lock);
+    }
+    // The hook runner sees stop and runs what is still pending first
+    pthread_cond_broadcast(&pool->changed);
+    while (pool->hook_thread) {
+        pthread_cond_wait(&pool->changed, &pool->lock);
+    }
+    report_completed_locked(pool);
+    while (pool->head) {
+        transfer_job *job = pool->head;
+        pool->head = job->next;
+        free(job->err_msg);
+        free(job);
+    }
+    pool->tail = NULL;
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->server_count; i++) {
+        if (pool->servers[i].idle_ready) {
+            pool->servers[i].idle_ready = false;
+            drop_session(&pool->servers[i].idle);
+        }
+    }
+}
+
+// Milliseconds the command loop may wait before idle housekeeping is due.
+// While transfers run they keep the session proven, so just check back later.
+static int pool_wait_ms(transfer_pool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    int ms;
+    if (pool->queued > 0 || pool->running > 0) {
+        ms = pool->opts->keepalive_interval * 1000;
+        // Wake up when the oldest waiting save reaches its latency bound
+        double now = monotonic_seconds();
+        for (transfer_job *job = pool->head; job && pool->opts->save_latency > 0; job = job->next) {
+            if (job->valid && !job->started && pool->flows[job->flow].save) {
+                double due = job->queued_at + pool->opts->save_latency - now;
+                int due_ms = due > 0 ? (int)(due * 1000) + 1 : 0;
+                if (due_ms < ms) {
+                    ms = due_ms;
+                }
+            }
+        }
+    } else {
+        ms = idle_wait_ms(pool->primary, pool->opts, pool->last_activity, pool->last_verified);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return ms;
+}
+
+// idle_tick for the primary connection. While transfers run, only check
+// whether a waiting save has become overdue.
+static void pool_idle_tick(transfer_pool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    bool busy = pool->queued > 0 || pool->running > 0;
+    time_t last_activity = pool->last_activity;
+    time_t last_verified = pool->last_verified;
+    if (busy) {
+        pool_ramp_locked(pool);
+        pthread_cond_broadcast(&pool->work);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (busy || pthread_mutex_trylock(&pool->primary_lock) != 0) {
+        return;
+    }
+    idle_tick(pool->primary, pool->standby, pool->opts, last_activity, &last_verified);
+    pthread_mutex_unlock(&pool->primary_lock);
+
+    pthread_mutex_lock(&pool->lock);
+    if (last_verified > pool->last_verified) {
+        pool->last_verified = last_verified;
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static bool pool_lost(transfer_pool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    bool lost = pool->fatal;
+    pthread_mutex_unlock(&pool->lock);
+    return lost;
+}
+
+// Persist what transfers learned about the server: a refused SCP channel
+// and the connection count where it refused another. Where throughput
+// levelled off depends on the network of the moment and stays in memory.
+static void remember_capabilities(transfer_pool *pool, transport_stats *transports, server_capabilities *caps, const char *path) {
+    bool changed = false;
+
+    pthread_mutex_lock(&transports->lock);
+    if (transports->scp_unavailable && caps->scp) {
+        caps->scp = false;
+        changed = true;
+    }
+    pthread_mutex_unlock(&transports->lock);
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->ceiling_changed) {
+        pool->ceiling_changed = false;
+        caps->max_connections = (unsigned)pool->ceiling;
+        changed = true;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (changed && path) {
+        capabilities_save(caps, path);
+    }
+}
+
+int main(int argc, char **argv) {
+    transmit_connection conn = {0};
+    transmit_standby standby = {0};
+    transmit_journal journal = { .fd = -1, .lock_fd = -1 };
+    transport_stats transports = { .lock = PTHREAD_MUTEX_INITIALIZER };
+    server_capabilities caps;
+    helper_options opts = { .want_standby = false, .journal_path = NULL, .capabilities_path = NULL, .keepalive_interval = DEFAULT_KEEPALIVE_SECONDS, .idle_timeout = 0, .save_latency = DEFAULT_SAVE_LATENCY_SECONDS };
+    line_reader reader = {0};
+    char input[2048];
+    char command[32], arg1[256], arg2[256], arg3[256];
+
+    conn.sock = -1;
+    srand((unsigned int)time(NULL) ^ (unsigned int)getpid());
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--standby") == 0) {
+            opts.want_standby = true;
+        } else if (strcmp(argv[i], "--keepalive") == 0 && i + 1 < argc) {
+            int seconds = atoi(argv[++i]);
+            if (seconds > 0) {
+                opts.keepalive_interval = seconds;
+            }
+        } else if (strcmp(argv[i], "--idle-timeout") == 0 && i + 1 < argc) {
+            int seconds = atoi(argv[++i]);
+            opts.idle_timeout = seconds > 0 ? seconds : 0;
+        } else if (strcmp(argv[i], "--journal") == 0 && i + 1 < argc) {
+            opts.journal_path = argv[++i];
+        } else if (strcmp(argv[i], "--capabilities") == 0 && i + 1 < argc) {
+            opts.capabilities_path = argv[++i];
+        } else if (strcmp(argv[i], "--save-latency") == 0 && i + 1 < argc) {
+            int seconds = atoi(argv[++i]);
+            opts.save_latency = seconds > 0 ? seconds : 0;
+        }
+    }
+    conn.keepalive_interval = opts.keepalive_interval;
     
     printf("Enter SSH hostname: ");
     fflush(stdout);
-    if (!fgets(hostname, sizeof(hostname), stdin)) {
+    if (read_line(&reader, conn.hostname, sizeof(conn.hostname), -1, -1) != 1) {
         printf("0|Failed to read hostname\n");
         return 1;
     }
-    hostname[strcspn(hostname, "\n")] = 0;
     
     printf("Enter SSH username: ");
     fflush(stdout);
-    if (!fgets(username, sizeof(username), stdin)) {
+    if (read_line(&reader, conn.username, sizeof(conn.username), -1, -1) != 1) {
         printf("0|Failed to read username\n");
         return 1;
     }
-    username[strcspn(username, "\n")] = 0;
     
-    printf("Authentication method (key/password): ");
+    printf("Authentication method (key/password/agent): ");
     fflush(stdout);
-    if (!fgets(auth_method, sizeof(auth_method), stdin)) {
+    if (read_line(&reader, conn.auth_method, sizeof(conn.auth_method), -1, -1) != 1) {
         printf("0|Failed to read auth method\n");
         return 1;
     }
-    auth_method[strcspn(auth_method, "\n")] = 0;
     
-	if (strcmp(auth_method, "password") == 0) {
+	if (strcmp(conn.auth_method, "password") == 0) {
 		printf("Enter password: ");
 		fflush(stdout);
-		if (!fgets(password, sizeof(password), stdin)) {
+		if (read_line(&reader, conn.password, sizeof(conn.password), -1, -1) != 1) {
 			printf("0|Failed to read password\n");
 			return 1;
 		}
-		password[strcspn(password, "\n")] = 0;
 
 		printf("DEBUG: Attempting password authentication...\n");  // ADD THIS
 		fflush(stdout);
 
-		if (init_sftp_session_password(hostname, username, password, &sftp_session, &session, &sock) != 0) {
+		if (connect_session(&conn) != 0) {
 			printf("0|Failed to establish SFTP session with password\n");
 			fflush(stdout);
 			return 1;
@@ -59,66 +1841,192 @@ int main() {
 
 		printf("DEBUG: Password authentication succeeded\n");  // ADD THIS
 		fflush(stdout);
+	} else if (strcmp(conn.auth_method, "agent") == 0) {
+        if (connect_session(&conn) != 0) {
+            printf("0|Failed to establish SFTP session with ssh-agent\n");
+            return 1;
+        }
 	} else {
         printf("Enter path to private key: ");
         fflush(stdout);
-        if (!fgets(privkey_path, sizeof(privkey_path), stdin)) {
+        if (read_line(&reader, conn.privkey_path, sizeof(conn.privkey_path), -1, -1) != 1) {
             printf("0|Failed to read private key path\n");
             return 1;
         }
-        privkey_path[strcspn(privkey_path, "\n")] = 0;
         
-        if (init_sftp_session(hostname, username, privkey_path, &sftp_session, &session, &sock) != 0) {
+        if (connect_session(&conn) != 0) {
             printf("0|Failed to establish SFTP session with key\n");
             return 1;
         }
     }
     
-    printf("1|Connected to %s as %s\n", hostname, username);
-    
-    while (1) {
-        if (!is_sftp_session_alive(sftp_session, session)) {
-            printf("0|SFTP session lost\n");
-            break;
+    // Announce the protocol first so frontends know it by the time they act
+    // on the connected line
+    printf("PROTOCOL|%d\n", TRANSMIT_PROTOCOL_VERSION);
+    printf("1|Connected to %s as %s\n", conn.hostname, conn.username);
+    printf("CREDIT|%d\n", COMMAND_WINDOW);
+
+    if (opts.want_standby && standby_start(&standby, &conn) != 0) {
+        fprintf(stderr, "DEBUG: Failed to start standby session thread\n");
+    }
+
+    // Reuse what we learned about this server last time; probing again only
+    // when there is no record, the host key changed or the record went stale
+    capabilities_defaults(&caps);
+    if (!opts.capabilities_path || capabilities_load(&caps, opts.capabilities_path) != 0 ||
+        !capabilities_current(&caps, conn.session)) {
+        capabilities_probe(&caps, conn.session, conn.sftp_session);
+        if (opts.capabilities_path) {
+            capabilities_save(&caps, opts.capabilities_path);
         }
-        
-        printf("Command (upload <local> <remote> | remove <remote> | exit): ");
+    }
+    transports.scp_unavailable = !caps.scp;
+    apply_transfer_limits(&conn, &caps);
+
+    size_t replayed = 0;
+    if (opts.journal_path && journal_open(&journal, opts.journal_path) == 0) {
+        replayed = replay_journal(&conn, &standby, &transports, &journal);
+    }
+    // Frontends hold back resends until here, so they can drop whatever the
+    // replay already finished instead of uploading it twice
+    printf("REPLAYED|%zu\n", replayed);
+    fflush(stdout);
+
+    transfer_pool pool = {0};
+    if (pool_start(&pool, &conn, &standby, &transports, &journal, &opts, &caps) != 0) {
+        printf("0|Failed to start transfer workers\n");
+        standby_stop(&standby);
+        drop_session(&conn);
+        journal_close(&journal);
+        return 1;
+    }
+
+    while (!pool_lost(&pool)) {
+        // A whole line, so it can't prefix the next result when commands are
+        // pipelined and output arrives in one chunk
+        printf("Command (upload <local> <remote> | remove <remote> | prewarm <remote> | focus | exit):\n");
         fflush(stdout);
-        
-        if (!fgets(input, sizeof(input), stdin)) {
+
+        // Batch journal fsyncs: one per burst of pipelined commands, taken
+        // before we would block waiting for more
+        if (!reader_has_line(&reader)) {
+            pthread_mutex_lock(&pool.lock);
+            journal_sync(&journal);
+            pthread_mutex_unlock(&pool.lock);
+        }
+
+        int rc;
+        while ((rc = read_line(&reader, input, sizeof(input), pool_wait_ms(&pool), pool.wake_fd[0])) == 0 &&
+               !pool_lost(&pool)) {
+            pool_idle_tick(&pool);
+        }
+
+        if (rc == 0) {
+            // The primary session is gone; its job already reported it
+            break;
+        }
+        if (rc < 0) {
             printf("0|Failed to read input\n");
             break;
         }
         
-        input[strcspn(input, "\n")] = 0;
-        command[0] = arg1[0] = arg2[0] = 0;
-        int num = sscanf(input, "%31s %255s %255s", command, arg1, arg2);
-        
+        command[0] = arg1[0] = arg2[0] = arg3[0] = 0;
+        int num = sscanf(input, "%31s %255s %255s %255s", command, arg1, arg2, arg3);
+
         if (strcmp(command, "exit") == 0) {
+            // Results of commands already sent come first
+            pool_stop(&pool);
             printf("1|Exiting shell\n");
             break;
-        } else if (strcmp(command, "upload") == 0 && num == 3) {
-            char *err_msg = NULL;
-            if (upload_file(sftp_session, arg1, arg2, &err_msg) == 0) {
-                printf("1|Upload succeeded\n");
-            } else {
-                printf("0|%s\n", err_msg ? err_msg : "Upload failed");
-                free(err_msg);
+        }
+
+        // Editor regained focus: get a usable session now rather than on
+        // save. Running transfers already prove it.
+        if (strcmp(command, "focus") == 0) {
+            pthread_mutex_lock(&pool.lock);
+            bool busy = pool.queued > 0 || pool.running > 0;
+            pool.last_activity = time(NULL);
+            pthread_mutex_unlock(&pool.lock);
+
+            if (!busy) {
+                pthread_mutex_lock(&pool.primary_lock);
+                bool alive = resume_session(&conn, &standby, &opts) == 0 && probe_session(&conn, &standby) == 0;
+                pthread_mutex_unlock(&pool.primary_lock);
+                if (alive) {
+                    pthread_mutex_lock(&pool.lock);
+                    pool.last_verified = time(NULL);
+                    pthread_mutex_unlock(&pool.lock);
+                }
+            }
+            continue;
+        }
+
+        // Frontend opened a project or buffer: stat its remote directory now
+        // so the first save skips the lookups. A transfer holding the primary
+        // connection will have warmed it anyway, so never wait for one.
+        if (strcmp(command, "prewarm") == 0 && num == 2) {
+            int state = -1;
+            if (pthread_mutex_trylock(&pool.primary_lock) != 0) {
+                printf("PREWARM|busy|%s\n", arg1);
+                continue;
+            }
+            if (resume_session(&conn, &standby, &opts) == 0) {
+                state = prewarm_remote_directory(conn.sftp_session, conn.session, arg1);
+                if (state < 0 && recover_session(&conn, &standby) == 0) {
+                    state = prewarm_remote_directory(conn.sftp_session, conn.session, arg1);
+                }
+            }
+            pthread_mutex_unlock(&pool.primary_lock);
+
+            pthread_mutex_lock(&pool.lock);
+            pool.last_activity = time(NULL);
+            if (state >= 0) {
+                pool.last_verified = time(NULL);
             }
-        } else if (strcmp(command, "remove") == 0 && num == 2) {
-            char *err_msg = NULL;
-            if (sftp_remove_path_recursive(sftp_session, arg1, &err_msg) == 0) {
-                printf("1|Remove succeeded\n");
+            pthread_mutex_unlock(&pool.lock);
+            printf("PREWARM|%s|%s\n", state > 0 ? "cached" : state == 0 ? "missing" : "failed", arg1);
+            continue;
+        }
+
+        // Run a command on the server whenever transfers under a remote root
+        // settle: hook <root> <quiet ms> [<command ...>]. No command drops it.
+        if (strcmp(command, "hook") == 0) {
+            char root[256] = "";
+            int quiet_ms = 0, offset = 0;
+            const char *reason = "usage: hook <root> <quiet ms> [<command>]";
+            input[strcspn(input, "\r\n")] = '\0';
+            if (sscanf(input, "%*s %255s %d %n", root, &quiet_ms, &offset) < 2 || offset == 0 ||
+                pool_set_hook(&pool, root, quiet_ms, input + offset, &reason) != 0) {
+                printf("HOOK|%s|rejected|%s\n", root, reason);
+            }
+            continue;
+        }
+
+        // Register another server as a copy endpoint:
+        // define <name> <user@host> <key|agent> [<private key>]
+        if (strcmp(command, "define") == 0) {
+            char name[64] = "", account[400] = "", method[16] = "", key[256] = "";
+            const char *reason = "usage: define <name> <user@host> <key|agent> [<private key>]";
+            if (sscanf(input, "%*s %63s %399s %15s %255s", name, account, method, key) >= 3 &&
+                pool_define_server(&pool, name, account, method, key, &reason) == 0) {
+                printf("DEFINE|%s|ok\n", name);
             } else {
-                printf("0|%s\n", err_msg ? err_msg : "Remove failed");
-                free(err_msg);
+                printf("DEFINE|%s|failed|%s\n", name, reason);
             }
-        } else {
-            printf("0|Unknown command or incorrect usage\n");
+            continue;
         }
+
+        // Uploads, removes, copies, release steps and usage errors all take
+        // a credit and report in the order they arrived
+        pool_submit(&pool, command, arg1, arg2, arg3, num);
+        remember_capabilities(&pool, &transports, &caps, opts.capabilities_path);
     }
     
-    close_sftp_session(sftp_session, session, sock);
+    pool_stop(&pool);
+    remember_capabilities(&pool, &transports, &caps, opts.capabilities_path);
+    standby_stop(&standby);
+    drop_session(&conn);
+    journal_close(&journal);
     printf("1|Session closed\n");
     return 0;
 }
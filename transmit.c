@@ -1,5 +1,7 @@
 // transmit.c
+#define _GNU_SOURCE  // asprintf
 #include <stdbool.h>
+#include <pthread.h>
 #include <libssh2.h>
 #include <libssh2_sftp.h>
 #include "transmit.h"
@@ -13,13 +15,51 @@
 #include <fcntl.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/file.h>
 #include <libgen.h>
 #include <sys/select.h>  // For select()
 #include <errno.h>
 #include <netdb.h>
+#include <time.h>
 
 #define SERVER_PORT 22
 
+#define RECONNECT_MAX_ATTEMPTS 8
+#define RECONNECT_BASE_DELAY_MS 250
+#define RECONNECT_MAX_DELAY_MS 30000
+#define TEARDOWN_TIMEOUT_MS 2000
+#define STANDBY_KEEPALIVE_SECONDS 30
+#define STANDBY_PROBE_TIMEOUT_MS 5000
+#define JOURNAL_COMPACT_BYTES (64 * 1024)
+#define SCP_CHUNK_BYTES (32 * 1024)
+#define CAPABILITIES_MAX_AGE (7 * 24 * 60 * 60)
+
+// Transfer limits when the server's are unknown: every SFTP server must
+// accept 32 KiB of write data, and a handful of handles is always safe
+#define SAFE_MAX_WRITE 32768
+#define SAFE_MAX_OPEN_HANDLES 16
+// What OpenSSH's sftp-server advertises through limits@openssh.com since 8.6;
+// its handle table is large, so only cap ourselves at a sane number
+#define OPENSSH_MAX_WRITE 261120
+#define OPENSSH_MAX_OPEN_HANDLES 64
+
+// libssh2_init/libssh2_exit keep an unguarded refcount; the standby thread
+// connects concurrently with the main thread, so serialise them
+static pthread_mutex_t libssh2_init_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int locked_libssh2_init(void) {
+    pthread_mutex_lock(&libssh2_init_lock);
+    int rc = libssh2_init(0);
+    pthread_mutex_unlock(&libssh2_init_lock);
+    return rc;
+}
+
+static void locked_libssh2_exit(void) {
+    pthread_mutex_lock(&libssh2_init_lock);
+    libssh2_exit();
+    pthread_mutex_unlock(&libssh2_init_lock);
+}
+
 static int resolve_hostname(const char *hostname, struct sockaddr_in *sin) {
     struct addrinfo hints, *result, *rp;
     int rc;
@@ -50,52 +90,170 @@ static int resolve_hostname(const char *hostname, struct sockaddr_in *sin) {
     return -1;
 }
 
+// Private key read once, so reconnects authenticate from memory instead of
+// reopening and reading the key file on the save path. The path never changes
+// during a run; the data stays valid until exit once loaded.
+static struct {
+    char path[256];
+    char *data;
+    size_t len;
+} key_cache;
+static pthread_mutex_t key_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Return the cached contents of privkey_path, loading them on first use
+static const char *cached_private_key(const char *privkey_path, size_t *len) {
+    pthread_mutex_lock(&key_cache_lock);
+    if (!key_cache.data) {
+        FILE *file = fopen(privkey_path, "rb");
+        if (file) {
+            char *data = NULL;
+            size_t size = 0;
+            if (fseek(file, 0, SEEK_END) == 0) {
+                long end = ftell(file);
+                if (end > 0 && fseek(file, 0, SEEK_SET) == 0) {
+                    data = malloc((size_t)end);
+                    size = data ? fread(data, 1, (size_t)end, file) : 0;
+                }
+            }
+            fclose(file);
+            if (data && size > 0) {
+                snprintf(key_cache.path, sizeof(key_cache.path), "%s", privkey_path);
+                key_cache.data = data;
+                key_cache.len = size;
+            } else {
+                free(data);
+            }
+        }
+    }
+
+    const char *data = NULL;
+    if (key_cache.data && strcmp(key_cache.path, privkey_path) == 0) {
+        data = key_cache.data;
+        *len = key_cache.len;
+    }
+    pthread_mutex_unlock(&key_cache_lock);
+    return data;
+}
+
+static int authenticate_with_key(LIBSSH2_SESSION *session, const char *username, const char *privkey_path) {
+    size_t len = 0;
+    const char *key = cached_private_key(privkey_path, &len);
+    if (key) {
+        // The public key is derived from the private one
+        int rc = libssh2_userauth_publickey_frommemory(session, username, strlen(username), NULL, 0, key, len, NULL);
+        if (rc == 0 || rc == LIBSSH2_ERROR_AUTHENTICATION_FAILED || rc == LIBSSH2_ERROR_PUBLICKEY_UNVERIFIED ||
+            is_connection_error(session)) {
+            return rc;
+        }
+        // Formats the crypto backend can't parse from memory still work
+        // through the file-based loader
+    }
+    return libssh2_userauth_publickey_fromfile(session, username, NULL, privkey_path, NULL);
+}
+
+// Try every identity held by ssh-agent; no key material is touched locally
+static int authenticate_with_agent(LIBSSH2_SESSION *session, const char *username) {
+    LIBSSH2_AGENT *agent = libssh2_agent_init(session);
+    if (!agent) {
+        return -1;
+    }
+
+    int rc = -1;
+    if (libssh2_agent_connect(agent) == 0 && libssh2_agent_list_identities(agent) == 0) {
+        struct libssh2_agent_publickey *identity = NULL;
+        struct libssh2_agent_publickey *previous = NULL;
+        while (libssh2_agent_get_identity(agent, &identity, previous) == 0) {
+            if (libssh2_agent_userauth(agent, username, identity) == 0) {
+                rc = 0;
+                break;
+            }
+            if (is_connection_error(session)) {
+                break;
+            }
+            previous = identity;
+        }
+    } else {
+        fprintf(stderr, "DEBUG: Could not reach ssh-agent (is SSH_AUTH_SOCK set?)\n");
+    }
+
+    libssh2_agent_disconnect(agent);
+    libssh2_agent_free(agent);
+    return rc;
+}
+
+// Undo a partially established session so failed attempts don't leak,
+// from any point after locked_libssh2_init()
+static void abort_session_init(LIBSSH2_SESSION **session, int sock) {
+    if (*session) {
+        libssh2_session_free(*session);
+        *session = NULL;
+    }
+    if (sock >= 0) {
+        close(sock);
+    }
+    locked_libssh2_exit();
+}
+
+// Failure result once the TCP connection is up: the server turning the
+// session down, unless the attempt merely timed out
+static int session_refusal(LIBSSH2_SESSION *session) {
+    int err = libssh2_session_last_errno(session);
+    return err == LIBSSH2_ERROR_TIMEOUT || err == LIBSSH2_ERROR_SOCKET_TIMEOUT ? -1 : SESSION_REFUSED;
+}
+
 int init_sftp_session(const char *hostname, const char *username, const char *privkey_path, LIBSSH2_SFTP **sftp_session, LIBSSH2_SESSION **session, int *sock) {
     int rc;
     struct sockaddr_in sin;
 
     // Init libssh2
-    rc = libssh2_init(0);
+    rc = locked_libssh2_init();
     if (rc != 0) {
         return -1;
     }
+    *session = NULL;
 
     // Create socket and connect
     *sock = socket(AF_INET, SOCK_STREAM, 0);
     if (*sock < 0) {
+        abort_session_init(session, *sock);
         return -1;
     }
     
     // Resolve hostname
     if (resolve_hostname(hostname, &sin) != 0) {
-        close(*sock);
+        abort_session_init(session, *sock);
         return -1;
     }
     
     if (connect(*sock, (struct sockaddr*)(&sin), sizeof(struct sockaddr_in)) != 0) {
-        close(*sock);
+        abort_session_init(session, *sock);
         return -1;
     }
 
     // Create SSH session
     *session = libssh2_session_init();
     if (libssh2_session_handshake(*session, *sock)) {
-        close(*sock);
-        return -1;
+        rc = session_refusal(*session);
+        abort_session_init(session, *sock);
+        return rc;
     }
 
-    // Authenticate with public key
-    const char *passphrase = NULL;
-    if (libssh2_userauth_publickey_fromfile(*session, username, NULL, privkey_path, passphrase)) {
-        close(*sock);
-        return -1;
+    // Authenticate with the private key, or with ssh-agent without one
+    int auth_rc = privkey_path
+        ? authenticate_with_key(*session, username, privkey_path)
+        : authenticate_with_agent(*session, username);
+    if (auth_rc != 0) {
+        rc = session_refusal(*session);
+        abort_session_init(session, *sock);
+        return rc;
     }
 
     // Init SFTP session
     *sftp_session = libssh2_sftp_init(*session);
     if (!(*sftp_session)) {
-        close(*sock);
-        return -1;
+        rc = session_refusal(*session);
+        abort_session_init(session, *sock);
+        return rc;
     }
 
     return 0;
@@ -107,23 +265,25 @@ int init_sftp_session_password(const char *hostname, const char *username, const
     memset(&sin, 0, sizeof(sin));  // Clear the structure
 
     fprintf(stderr, "DEBUG: Initializing libssh2...\n");
-    rc = libssh2_init(0);
+    rc = locked_libssh2_init();
     if (rc != 0) {
         fprintf(stderr, "DEBUG: libssh2_init failed: %d\n", rc);
         return -1;
     }
+    *session = NULL;
 
     fprintf(stderr, "DEBUG: Creating socket...\n");
     *sock = socket(AF_INET, SOCK_STREAM, 0);
     if (*sock < 0) {
         fprintf(stderr, "DEBUG: socket creation failed\n");
+        abort_session_init(session, *sock);
         return -1;
     }
     
     fprintf(stderr, "DEBUG: Resolving hostname: %s...\n", hostname);
     if (resolve_hostname(hostname, &sin) != 0) {
         fprintf(stderr, "DEBUG: Failed to resolve hostname: %s\n", hostname);
-        close(*sock);
+        abort_session_init(session, *sock);
         return -1;
     }
     
@@ -132,7 +292,7 @@ int init_sftp_session_password(const char *hostname, const char *username, const
     fprintf(stderr, "DEBUG: Connecting to %s:22...\n", hostname);
     if (connect(*sock, (struct sockaddr*)(&sin), sizeof(struct sockaddr_in)) != 0) {
         fprintf(stderr, "DEBUG: connect failed: %s\n", strerror(errno));
-        close(*sock);
+        abort_session_init(session, *sock);
         return -1;
     }
     fprintf(stderr, "DEBUG: Creating SSH session...\n");
@@ -141,8 +301,9 @@ int init_sftp_session_password(const char *hostname, const char *username, const
     fprintf(stderr, "DEBUG: Starting SSH handshake...\n");
     if (libssh2_session_handshake(*session, *sock)) {
         fprintf(stderr, "DEBUG: SSH handshake failed\n");
-        close(*sock);
-        return -1;
+        rc = session_refusal(*session);
+        abort_session_init(session, *sock);
+        return rc;
     }
 
     fprintf(stderr, "DEBUG: Authenticating with password...\n");
@@ -152,16 +313,18 @@ int init_sftp_session_password(const char *hostname, const char *username, const
         int err_len;
         int err = libssh2_session_last_error(*session, &err_msg, &err_len, 0);
         fprintf(stderr, "DEBUG: libssh2 error %d: %s\n", err, err_msg);
-        close(*sock);
-        return -1;
+        rc = session_refusal(*session);
+        abort_session_init(session, *sock);
+        return rc;
     }
 
     fprintf(stderr, "DEBUG: Initializing SFTP...\n");
     *sftp_session = libssh2_sftp_init(*session);
     if (!(*sftp_session)) {
         fprintf(stderr, "DEBUG: SFTP init failed\n");
-        close(*sock);
-        return -1;
+        rc = session_refusal(*session);
+        abort_session_init(session, *sock);
+        return rc;
     }
 
     fprintf(stderr, "DEBUG: Connection successful!\n");
@@ -195,16 +358,297 @@ int is_sftp_session_alive(LIBSSH2_SFTP *sftp_session, LIBSSH2_SESSION *session)
         return 1; // Session is alive
     }
 
-    int err = libssh2_session_last_error(session, NULL, NULL, 0);
-    if (err == LIBSSH2_ERROR_SOCKET_DISCONNECT ||
-        err == LIBSSH2_ERROR_CHANNEL_CLOSED ||
-        err == LIBSSH2_ERROR_SOCKET_SEND ||
-        err == LIBSSH2_ERROR_SOCKET_TIMEOUT) {
+    if (is_connection_error(session)) {
         return 0; // Definitely disconnected
     }
 
     return 1; // Might just be a missing file or permission error
 }
+// Whether the last libssh2 error means the transport itself is gone, as
+// opposed to a per-file failure such as a missing path or permissions
+int is_connection_error(LIBSSH2_SESSION *session) {
+    if (!session) {
+        return 1;
+    }
+
+    int err = libssh2_session_last_errno(session);
+    return err == LIBSSH2_ERROR_SOCKET_DISCONNECT ||
+           err == LIBSSH2_ERROR_SOCKET_SEND ||
+           err == LIBSSH2_ERROR_SOCKET_RECV ||
+           err == LIBSSH2_ERROR_SOCKET_TIMEOUT ||
+           err == LIBSSH2_ERROR_TIMEOUT ||
+           err == LIBSSH2_ERROR_CHANNEL_CLOSED ||
+           err == LIBSSH2_ERROR_BAD_SOCKET;
+}
+
+// Copy only the credentials of from, leaving to without a session
+void connection_template(const transmit_connection *from, transmit_connection *to) {
+    memset(to, 0, sizeof(*to));
+    memcpy(to->hostname, from->hostname, sizeof(to->hostname));
+    memcpy(to->username, from->username, sizeof(to->username));
+    memcpy(to->auth_method, from->auth_method, sizeof(to->auth_method));
+    memcpy(to->privkey_path, from->privkey_path, sizeof(to->privkey_path));
+    memcpy(to->password, from->password, sizeof(to->password));
+    to->keepalive_interval = from->keepalive_interval;
+    to->max_write = from->max_write;
+    to->max_open_handles = from->max_open_handles;
+    to->sock = -1;
+}
+
+// Establish a session from the credentials held in conn. Returns 0,
+// SESSION_REFUSED when the server answered and declined, or -1.
+int connect_session(transmit_connection *conn) {
+    conn->sftp_session = NULL;
+    conn->session = NULL;
+    conn->sock = -1;
+
+    int rc;
+    if (strcmp(conn->auth_method, "password") == 0) {
+        rc = init_sftp_session_password(conn->hostname, conn->username, conn->password, &conn->sftp_session, &conn->session, &conn->sock);
+    } else if (strcmp(conn->auth_method, "agent") == 0) {
+        rc = init_sftp_session(conn->hostname, conn->username, NULL, &conn->sftp_session, &conn->session, &conn->sock);
+    } else {
+        rc = init_sftp_session(conn->hostname, conn->username, conn->privkey_path, &conn->sftp_session, &conn->session, &conn->sock);
+    }
+
+    // SSH-level keepalives are cheap and keep NAT/firewall state from expiring
+    if (rc == 0 && conn->keepalive_interval > 0) {
+        libssh2_keepalive_config(conn->session, 1, conn->keepalive_interval);
+    }
+    return rc;
+}
+
+// Tear down whatever is left of a session; bounded so a dead peer can't hang us
+void drop_session(transmit_connection *conn) {
+    if (!conn->session) {
+        return;
+    }
+
+    libssh2_session_set_timeout(conn->session, TEARDOWN_TIMEOUT_MS);
+    close_sftp_session(conn->sftp_session, conn->session, conn->sock);
+    conn->sftp_session = NULL;
+    conn->session = NULL;
+    conn->sock = -1;
+}
+
+static void sleep_ms(long ms) {
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000L;
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+}
+
+// Exponential backoff with equal jitter: half the window is fixed, half is
+// random, so helpers that lost the same link don't retry in lockstep
+static long backoff_delay_ms(int attempt) {
+    long window = RECONNECT_MAX_DELAY_MS;
+    if (attempt < 16) {
+        window = (long)RECONNECT_BASE_DELAY_MS << attempt;
+        if (window > RECONNECT_MAX_DELAY_MS) {
+            window = RECONNECT_MAX_DELAY_MS;
+        }
+    }
+    return window / 2 + rand() % (window / 2 + 1);
+}
+
+// Replace a dead session with a fresh one. The first attempt is immediate,
+// later ones back off. Returns 0 once connected again.
+int reconnect_session(transmit_connection *conn) {
+    drop_session(conn);
+
+    for (int attempt = 0; attempt < RECONNECT_MAX_ATTEMPTS; attempt++) {
+        long delay = attempt == 0 ? 0 : backoff_delay_ms(attempt - 1);
+        printf("RECONNECT|%d|%ld\n", attempt + 1, delay);
+        fflush(stdout);
+
+        if (delay > 0) {
+            sleep_ms(delay);
+        }
+
+        if (connect_session(conn) == 0) {
+            printf("RECONNECTED|%s\n", conn->hostname);
+            fflush(stdout);
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+static void standby_wait_ms(transmit_standby *standby, long ms) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += ms / 1000;
+    deadline.tv_nsec += (ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(&standby->wake, &standby->lock, &deadline);
+}
+
+// Spare-session thread: builds a spare whenever there is none, tears down
+// sessions retired by a failover, and keeps the idle spare alive. State is
+// guarded by standby->lock, dropped around anything that blocks on the
+// network: connects, teardowns and liveness probes.
+static void *standby_main(void *arg) {
+    transmit_standby *standby = arg;
+    int failures = 0;
+
+    pthread_mutex_lock(&standby->lock);
+    while (!standby->stop) {
+        if (standby->retired.session) {
+            transmit_connection retired = standby->retired;
+            memset(&standby->retired, 0, sizeof(standby->retired));
+            pthread_mutex_unlock(&standby->lock);
+            drop_session(&retired);
+            pthread_mutex_lock(&standby->lock);
+            continue;
+        }
+
+        if (!standby->ready) {
+            transmit_connection spare = standby->template;
+            pthread_mutex_unlock(&standby->lock);
+            int rc = connect_session(&spare);
+            pthread_mutex_lock(&standby->lock);
+
+            if (rc != 0) {
+                standby_wait_ms(standby, backoff_delay_ms(failures++));
+                continue;
+            }
+
+            failures = 0;
+            libssh2_keepalive_config(spare.session, 1, STANDBY_KEEPALIVE_SECONDS);
+            standby->conn = spare;
+            standby->ready = 1;
+            continue;
+        }
+
+        standby_wait_ms(standby, STANDBY_KEEPALIVE_SECONDS * 1000L);
+        if (standby->stop || !standby->ready || standby->retired.session) {
+            continue;
+        }
+
+        // Probe the spare out of reach, so a failover never waits on the
+        // lock for it; one arriving meanwhile reconnects instead
+        transmit_connection spare = standby->conn;
+        memset(&standby->conn, 0, sizeof(standby->conn));
+        standby->ready = 0;
+        pthread_mutex_unlock(&standby->lock);
+
+        // The keepalive holds NAT state; the stat proves the spare still answers
+        int seconds_to_next = 0;
+        libssh2_session_set_timeout(spare.session, STANDBY_PROBE_TIMEOUT_MS);
+        int alive = libssh2_keepalive_send(spare.session, &seconds_to_next) == 0 &&
+                    is_sftp_session_alive(spare.sftp_session, spare.session);
+        libssh2_session_set_timeout(spare.session, 0);
+        if (!alive) {
+            drop_session(&spare);
+        }
+
+        pthread_mutex_lock(&standby->lock);
+        if (alive) {
+            standby->conn = spare;
+            standby->ready = 1;
+        }
+    }
+
+    transmit_connection spare = standby->conn;
+    memset(&standby->conn, 0, sizeof(standby->conn));
+    standby->ready = 0;
+    pthread_mutex_unlock(&standby->lock);
+
+    drop_session(&spare);
+    return NULL;
+}
+
+// Start keeping a spare session for the server conn is connected to
+int standby_start(transmit_standby *standby, const transmit_connection *conn) {
+    memset(standby, 0, sizeof(*standby));
+    standby->template = *conn;
+    standby->template.sftp_session = NULL;
+    standby->template.session = NULL;
+    standby->template.sock = -1;
+
+    pthread_mutex_init(&standby->lock, NULL);
+    pthread_cond_init(&standby->wake, NULL);
+
+    if (pthread_create(&standby->thread, NULL, standby_main, standby) != 0) {
+        pthread_cond_destroy(&standby->wake);
+        pthread_mutex_destroy(&standby->lock);
+        return -1;
+    }
+
+    standby->running = 1;
+    return 0;
+}
+
+// Swap a ready spare in for conn. The dead session goes to the standby thread
+// for teardown and a replacement spare is built in the background.
+int standby_take(transmit_standby *standby, transmit_connection *conn) {
+    if (!standby || !standby->running) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&standby->lock);
+    if (!standby->ready) {
+        pthread_mutex_unlock(&standby->lock);
+        return -1;
+    }
+
+    transmit_connection dead = *conn;
+    *conn = standby->conn;
+    // The spare was templated before the server's limits were known
+    conn->max_write = dead.max_write;
+    conn->max_open_handles = dead.max_open_handles;
+    memset(&standby->conn, 0, sizeof(standby->conn));
+    standby->ready = 0;
+
+    int handed_off = 0;
+    if (!standby->retired.session) {
+        standby->retired = dead;
+        handed_off = 1;
+    }
+    pthread_cond_signal(&standby->wake);
+    pthread_mutex_unlock(&standby->lock);
+
+    if (!handed_off) {
+        drop_session(&dead);
+    }
+    return 0;
+}
+
+void standby_stop(transmit_standby *standby) {
+    if (!standby->running) {
+        return;
+    }
+
+    pthread_mutex_lock(&standby->lock);
+    standby->stop = 1;
+    pthread_cond_signal(&standby->wake);
+    pthread_mutex_unlock(&standby->lock);
+
+    pthread_join(standby->thread, NULL);
+    drop_session(&standby->retired);
+    pthread_cond_destroy(&standby->wake);
+    pthread_mutex_destroy(&standby->lock);
+    standby->running = 0;
+}
+
+// Get conn working again after a transport failure: fail over to the warm
+// spare when one is ready, otherwise reconnect with backoff
+int recover_session(transmit_connection *conn, transmit_standby *standby) {
+    if (standby_take(standby, conn) == 0 &&
+        is_sftp_session_alive(conn->sftp_session, conn->session)) {
+        printf("FAILOVER|%s\n", conn->hostname);
+        fflush(stdout);
+        return 0;
+    }
+
+    return reconnect_session(conn);
+}
+
 /* int is_session_alive(LIBSSH2_SESSION *session) { */
 /* 	int rc; */
 /* 	int seconds_to_next = 0; */
@@ -215,11 +659,13 @@ int is_sftp_session_alive(LIBSSH2_SFTP *sftp_session, LIBSSH2_SESSION *session)
 
 // Function to close the SFTP connection
 void close_sftp_session(LIBSSH2_SFTP *sftp_session, LIBSSH2_SESSION *session, int sock) {
-    libssh2_sftp_shutdown(sftp_session);
+    if (sftp_session) {
+        libssh2_sftp_shutdown(sftp_session);
+    }
     libssh2_session_disconnect(session, "Normal Shutdown");
     libssh2_session_free(session);
     close(sock);
-    libssh2_exit();
+    locked_libssh2_exit();
 }
 
 bool is_directory(const char *path) {
@@ -232,7 +678,7 @@ bool is_directory(const char *path) {
 }
 
 // Function to upload a single file
-int upload_file(LIBSSH2_SFTP *sftp_session, const char *local_file, const char *remote_file, char **err_msg) {
+int upload_file(LIBSSH2_SFTP *sftp_session, const char *local_file, const char *remote_file, size_t chunk_bytes, char **err_msg) {
     char path_copy[1024];
     snprintf(path_copy, sizeof(path_copy), "%s", remote_file);
 
@@ -258,6 +704,20 @@ int upload_file(LIBSSH2_SFTP *sftp_session, const char *local_file, const char *
         LIBSSH2_SFTP_S_IRUSR | LIBSSH2_SFTP_S_IWUSR
     );
 
+    // The cached directory may have been removed by someone else; forget it
+    // and create the tree again once
+    if (!sftp_handle && libssh2_sftp_last_error(sftp_session) == LIBSSH2_FX_NO_SUCH_FILE) {
+        dir_cache_forget(dir_path);
+        if (create_remote_directory_recursively(sftp_session, dir_path) == 0) {
+            sftp_handle = libssh2_sftp_open(
+                sftp_session,
+                remote_file,
+                LIBSSH2_FXF_WRITE | LIBSSH2_FXF_CREAT | LIBSSH2_FXF_TRUNC,
+                LIBSSH2_SFTP_S_IRUSR | LIBSSH2_SFTP_S_IWUSR
+            );
+        }
+    }
+
     if (!sftp_handle) {
         unsigned long err_code = libssh2_sftp_last_error(sftp_session);
         asprintf(err_msg, "Unable to open remote file '%s' (libssh2 error %lu)", remote_file, err_code);
@@ -276,11 +736,18 @@ int upload_file(LIBSSH2_SFTP *sftp_session, const char *local_file, const char *
     long total_size = ftell(local);
     fseek(local, 0, SEEK_SET);
 
+    char *mem = malloc(chunk_bytes);
+    if (!mem) {
+        asprintf(err_msg, "Out of memory while uploading: %s", local_file);
+        fclose(local);
+        libssh2_sftp_close(sftp_handle);
+        return 1;
+    }
+
     long bytes_uploaded = 0;
-    char mem[1024];
     size_t nread;
 
-    while ((nread = fread(mem, 1, sizeof(mem), local)) > 0) {
+    while ((nread = fread(mem, 1, chunk_bytes, local)) > 0) {
         char *ptr = mem;
         size_t remaining = nread;
 
@@ -288,6 +755,7 @@ int upload_file(LIBSSH2_SFTP *sftp_session, const char *local_file, const char *
             ssize_t nwritten = libssh2_sftp_write(sftp_handle, ptr, remaining);
             if (nwritten < 0) {
                 asprintf(err_msg, "SFTP write error while writing to: %s", remote_file);
+                free(mem);
                 fclose(local);
                 libssh2_sftp_close(sftp_handle);
                 return 1;
@@ -304,6 +772,7 @@ int upload_file(LIBSSH2_SFTP *sftp_session, const char *local_file, const char *
         }
     }
 
+    free(mem);
     fclose(local);
     libssh2_sftp_close(sftp_handle);
 
@@ -314,47 +783,282 @@ int upload_file(LIBSSH2_SFTP *sftp_session, const char *local_file, const char *
     return 0;
 }
 
+// Upload a file over a plain SCP channel. The data is a single stream that is
+// only bounded by the channel window, not by per-write SFTP acknowledgements.
+// The SFTP session is still used to create the remote directory tree.
+// Returns 0 on success, 1 on failure, 2 if the server doesn't offer SCP and
+// 3 if it rejected this one file over SCP (a path it can't write, say). In
+// the last two cases nothing was written and the caller should fall back to
+// SFTP, which reports per-file errors properly.
+int scp_upload_file(LIBSSH2_SESSION *session, LIBSSH2_SFTP *sftp_session, const char *local_file, const char *remote_file, char **err_msg) {
+    char path_copy[1024];
+    snprintf(path_copy, sizeof(path_copy), "%s", remote_file);
+
+    struct stat st;
+    if (stat(local_file, &st) != 0) {
+        asprintf(err_msg, "Failed to open local file: %s", local_file);
+        return 1;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        asprintf(err_msg, "Uploading directories is not supported: %s", local_file);
+        return 1;
+    }
+
+    char *dir_path = dirname(path_copy);
+    if (create_remote_directory_recursively(sftp_session, dir_path)) {
+        asprintf(err_msg, "Failed to create remote directory recursively: %s", dir_path);
+        return 1;
+    }
+
+    FILE *local = fopen(local_file, "rb");
+    if (!local) {
+        asprintf(err_msg, "Failed to open local file: %s", local_file);
+        return 1;
+    }
+
+    // Same permissions SFTP uses when it creates the file
+    LIBSSH2_CHANNEL *channel = libssh2_scp_send64(session, remote_file, 0600, (libssh2_int64_t)st.st_size, 0, 0);
+    if (!channel) {
+        fclose(local);
+        if (is_connection_error(session)) {
+            asprintf(err_msg, "Unable to open SCP channel for '%s'", remote_file);
+            return 1;
+        }
+        // Only a refused channel or exec request says SCP is unavailable;
+        // a protocol error is the remote scp rejecting this path
+        int err = libssh2_session_last_errno(session);
+        return err == LIBSSH2_ERROR_CHANNEL_REQUEST_DENIED || err == LIBSSH2_ERROR_CHANNEL_FAILURE ? 2 : 3;
+    }
+
+    long long bytes_uploaded = 0;
+    int last_percent = -1;
+    char mem[SCP_CHUNK_BYTES];
+    size_t nread;
+    int rc = 0;
+
+    while (rc == 0 && (nread = fread(mem, 1, sizeof(mem), local)) > 0) {
+        char *ptr = mem;
+        size_t remaining = nread;
+
+        while (remaining > 0) {
+            ssize_t nwritten = libssh2_channel_write(channel, ptr, remaining);
+            if (nwritten < 0) {
+                asprintf(err_msg, "SCP write error while writing to: %s", remote_file);
+                rc = 1;
+                break;
+            }
+
+            ptr += nwritten;
+            remaining -= nwritten;
+            bytes_uploaded += nwritten;
+
+            int percent = st.st_size > 0 ? (int)(bytes_uploaded * 100 / st.st_size) : 100;
+            if (percent != last_percent) {
+                printf("PROGRESS|%s|%d\n", local_file, percent);
+                fflush(stdout);
+                last_percent = percent;
+            }
+        }
+    }
+
+    if (rc == 0 && bytes_uploaded != (long long)st.st_size) {
+        asprintf(err_msg, "Local file changed size during upload: %s", local_file);
+        rc = 1;
+    }
+    fclose(local);
+
+    // The remote scp only reports success through its exit status
+    if (rc == 0) {
+        libssh2_channel_send_eof(channel);
+        libssh2_channel_wait_eof(channel);
+        libssh2_channel_wait_closed(channel);
+        if (libssh2_channel_get_exit_status(channel) != 0) {
+            asprintf(err_msg, "SCP upload of '%s' failed on the server", remote_file);
+            rc = 1;
+        }
+    }
+    libssh2_channel_free(channel);
 
+    return rc;
+}
 
 int create_directory(LIBSSH2_SFTP *sftp_session, const char *directory) {
 	return create_remote_directory_recursively(sftp_session, directory);
 }
 
+// Remote directories known to exist, so repeated uploads into the same tree
+// skip the per-component stat round trips. Kept across reconnects since the
+// remote filesystem does not change with the session.
+#define DIR_CACHE_BUCKETS 1024
+#define DIR_CACHE_MAX_ENTRIES 8192
+
+typedef struct dir_cache_entry {
+    struct dir_cache_entry *next;
+    char path[];
+} dir_cache_entry;
+
+static dir_cache_entry *dir_cache[DIR_CACHE_BUCKETS];
+static size_t dir_cache_entries = 0;
+static pthread_mutex_t dir_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned long dir_cache_hash(const char *path) {
+    unsigned long hash = 5381;
+    for (const unsigned char *p = (const unsigned char *)path; *p; p++) {
+        hash = hash * 33 + *p;
+    }
+    return hash % DIR_CACHE_BUCKETS;
+}
+
+static void dir_cache_clear_locked(void) {
+    for (size_t i = 0; i < DIR_CACHE_BUCKETS; i++) {
+        dir_cache_entry *entry = dir_cache[i];
+        while (entry) {
+            dir_cache_entry *next = entry->next;
+            free(entry);
+            entry = next;
+        }
+        dir_cache[i] = NULL;
+    }
+    dir_cache_entries = 0;
+}
+
+static bool dir_cache_contains(const char *path) {
+    bool found = false;
+    pthread_mutex_lock(&dir_cache_lock);
+    for (dir_cache_entry *entry = dir_cache[dir_cache_hash(path)]; entry; entry = entry->next) {
+        if (strcmp(entry->path, path) == 0) {
+            found = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&dir_cache_lock);
+    return found;
+}
+
+static void dir_cache_add(const char *path) {
+    if (dir_cache_contains(path)) {
+        return;
+    }
+
+    size_t len = strlen(path);
+    dir_cache_entry *entry = malloc(sizeof(*entry) + len + 1);
+    if (!entry) {
+        return;
+    }
+    memcpy(entry->path, path, len + 1);
+
+    pthread_mutex_lock(&dir_cache_lock);
+    // Crude bound: a project that touches this many directories just starts over
+    if (dir_cache_entries >= DIR_CACHE_MAX_ENTRIES) {
+        dir_cache_clear_locked();
+    }
+    unsigned long bucket = dir_cache_hash(path);
+    entry->next = dir_cache[bucket];
+    dir_cache[bucket] = entry;
+    dir_cache_entries++;
+    pthread_mutex_unlock(&dir_cache_lock);
+}
+
+// Drop path and everything below it, e.g. after a remove
+void dir_cache_forget(const char *path) {
+    size_t len = strlen(path);
+    while (len > 1 && path[len - 1] == '/') {
+        len--;
+    }
+
+    pthread_mutex_lock(&dir_cache_lock);
+    for (size_t i = 0; i < DIR_CACHE_BUCKETS; i++) {
+        dir_cache_entry **link = &dir_cache[i];
+        while (*link) {
+            dir_cache_entry *entry = *link;
+            if (strncmp(entry->path, path, len) == 0 && (entry->path[len] == '\0' || entry->path[len] == '/')) {
+                *link = entry->next;
+                free(entry);
+                dir_cache_entries--;
+            } else {
+                link = &entry->next;
+            }
+        }
+    }
+    pthread_mutex_unlock(&dir_cache_lock);
+}
+
+// Cache path and all of its ancestors; an existing directory implies them
+static void dir_cache_add_with_parents(const char *path) {
+    char current_path[1024];
+    snprintf(current_path, sizeof(current_path), "%s", path);
+
+    while (strlen(current_path) > 0 && strcmp(current_path, "/") != 0 && strcmp(current_path, ".") != 0) {
+        if (dir_cache_contains(current_path)) {
+            return;
+        }
+        dir_cache_add(current_path);
+
+        char *slash = strrchr(current_path, '/');
+        if (!slash) {
+            return;
+        }
+        if (slash == current_path) {
+            slash[1] = '\0';
+        } else {
+            *slash = '\0';
+        }
+    }
+}
+
+static int remote_stat_kind(LIBSSH2_SFTP *sftp_session, const char *path) {
+    LIBSSH2_SFTP_ATTRIBUTES attrs;
+    if (libssh2_sftp_stat(sftp_session, path, &attrs) != 0) {
+        return -1;
+    }
+    if ((attrs.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS) && ((attrs.permissions & LIBSSH2_SFTP_S_IFMT) != LIBSSH2_SFTP_S_IFDIR)) {
+        return 0;
+    }
+    return 1;
+}
+
 // Function to create remote directories recursively
 int create_remote_directory_recursively(LIBSSH2_SFTP *sftp_session, const char *path) {
-	LIBSSH2_SFTP_ATTRIBUTES attrs;
-	int rc = libssh2_sftp_stat(sftp_session, path, &attrs);
+	if (dir_cache_contains(path)) {
+		return 0;
+	}
 
-	if (rc == 0 && ((attrs.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS) && ((attrs.permissions & LIBSSH2_SFTP_S_IFMT) == LIBSSH2_SFTP_S_IFDIR))) {
+	if (remote_stat_kind(sftp_session, path) == 1) {
+		dir_cache_add_with_parents(path);
 		return 0;
 	}
 
 	char dir_path[1024];
     char *dir_part;
-    size_t path_len = strlen(path);
+    char *save_ptr = NULL;
 
-    strncpy(dir_path, path, sizeof(dir_path));
-    dir_path[path_len] = '\0';  // Null-terminate the path string
+    snprintf(dir_path, sizeof(dir_path), "%s", path);
 
     char current_path[1024];  // Ensure each path part is safely copied into current_path
-    current_path[0] = '\0';   // Initialize the current_path as empty
+    // Keep the leading slash so absolute paths are not resolved against the login directory
+    snprintf(current_path, sizeof(current_path), "%s", path[0] == '/' ? "/" : "");
     // Check each part of the path and create the directories as needed
-    for (dir_part = strtok(dir_path, "/"); dir_part != NULL; dir_part = strtok(NULL, "/")) {
+    // strtok_r: transfer workers create directories concurrently
+    for (dir_part = strtok_r(dir_path, "/", &save_ptr); dir_part != NULL; dir_part = strtok_r(NULL, "/", &save_ptr)) {
         // Append the directory part to the current path with a separator
-        if (strlen(current_path) > 0) {
+        size_t current_len = strlen(current_path);
+        if (current_len > 0 && current_path[current_len - 1] != '/') {
             strcat(current_path, "/");
         }
         strcat(current_path, dir_part);
 
-		LIBSSH2_SFTP_ATTRIBUTES directory_attrs;
-		int rc = libssh2_sftp_stat(sftp_session, current_path, &directory_attrs);
+		if (dir_cache_contains(current_path)) {
+			continue;
+		}
+
+		int kind = remote_stat_kind(sftp_session, current_path);
 
-		if (rc == 0 && ((directory_attrs.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS) && ((directory_attrs.permissions & LIBSSH2_SFTP_S_IFMT) != LIBSSH2_SFTP_S_IFDIR))) {
+		if (kind == 0) {
 			/* fprintf(stderr, "Failed to create directory, path exists and is not a directory: %s\n", current_path); */
 			return 1;
 		}
 
-		if (rc != 0) {
+		if (kind < 0) {
 			// Attempt to create the directory
 			if (libssh2_sftp_mkdir(sftp_session, current_path, LIBSSH2_SFTP_S_IRUSR | LIBSSH2_SFTP_S_IWUSR | LIBSSH2_SFTP_S_IXUSR) != 0) {
 				/* fprintf(stderr, "Failed to create directory here: %s\n", current_path); */
@@ -363,13 +1067,80 @@ int create_remote_directory_recursively(LIBSSH2_SFTP *sftp_session, const char *
 
 			/* printf("Created directory: %s\n", current_path); */
 		}
+
+		dir_cache_add(current_path);
 	}
 
     return 0;
 }
 
+// Stat a remote directory ahead of the first upload into it, caching it (or
+// its nearest existing ancestor) without creating anything.
+// Returns 1 if the directory exists, 0 if not, -1 on a session error.
+int prewarm_remote_directory(LIBSSH2_SFTP *sftp_session, LIBSSH2_SESSION *session, const char *path) {
+    if (dir_cache_contains(path)) {
+        return 1;
+    }
+
+    char current_path[1024];
+    snprintf(current_path, sizeof(current_path), "%s", path);
+
+    int exists = 1;
+    while (strlen(current_path) > 0) {
+        int kind = remote_stat_kind(sftp_session, current_path);
+        if (kind == 1) {
+            dir_cache_add_with_parents(current_path);
+            return exists;
+        }
+        if (kind < 0 && is_connection_error(session)) {
+            return -1;
+        }
+        exists = 0;
+
+        char *slash = strrchr(current_path, '/');
+        if (!slash || slash == current_path) {
+            break;
+        }
+        *slash = '\0';
+    }
+
+    return 0;
+}
+
+
+// Names of subdirectories still to descend into once a listing is closed
+typedef struct {
+    char **names;
+    size_t count;
+    size_t capacity;
+} deferred_dirs;
+
+static int deferred_dirs_add(deferred_dirs *dirs, const char *path) {
+    if (dirs->count == dirs->capacity) {
+        size_t capacity = dirs->capacity ? dirs->capacity * 2 : 16;
+        char **names = realloc(dirs->names, capacity * sizeof(*names));
+        if (!names) {
+            return -1;
+        }
+        dirs->names = names;
+        dirs->capacity = capacity;
+    }
+    dirs->names[dirs->count] = strdup(path);
+    return dirs->names[dirs->count++] ? 0 : -1;
+}
+
+static void deferred_dirs_free(deferred_dirs *dirs) {
+    for (size_t i = 0; i < dirs->count; i++) {
+        free(dirs->names[i]);
+    }
+    free(dirs->names);
+}
 
-int sftp_remove_path_recursive(LIBSSH2_SFTP *sftp_session, const char *path, char **err_msg) {
+// depth is the number of directory handles held by the ancestors of path.
+// Each level of recursion holds its directory handle open while it descends.
+// Once that would exceed the server's handle limit, a level lists itself
+// completely and closes its handle before descending instead.
+static int remove_path_at_depth(LIBSSH2_SFTP *sftp_session, const char *path, unsigned depth, unsigned max_handles, char **err_msg) {
     LIBSSH2_SFTP_ATTRIBUTES stat_attrs;
     if (libssh2_sftp_stat(sftp_session, path, &stat_attrs) != 0) {
         unsigned long err = libssh2_sftp_last_error(sftp_session);
@@ -399,6 +1170,8 @@ int sftp_remove_path_recursive(LIBSSH2_SFTP *sftp_session, const char *path, cha
 
     char buffer[512];
     char entry[256];
+    bool hold_handle = depth + 1 < max_handles;
+    deferred_dirs later = {0};
 
     while (1) {
         LIBSSH2_SFTP_ATTRIBUTES attrs;
@@ -412,13 +1185,21 @@ int sftp_remove_path_recursive(LIBSSH2_SFTP *sftp_session, const char *path, cha
         snprintf(buffer, sizeof(buffer), "%s/%s", path, entry);
 
         if (LIBSSH2_SFTP_S_ISDIR(attrs.permissions)) {
-            if (sftp_remove_path_recursive(sftp_session, buffer, err_msg) != 0) {
+            int rc = hold_handle
+                ? remove_path_at_depth(sftp_session, buffer, depth + 1, max_handles, err_msg)
+                : deferred_dirs_add(&later, buffer);
+            if (rc != 0) {
+                if (!*err_msg) {
+                    asprintf(err_msg, "Out of memory while removing: %s", path);
+                }
+                deferred_dirs_free(&later);
                 libssh2_sftp_closedir(dir);
                 return -1;
             }
         } else {
             if (libssh2_sftp_unlink(sftp_session, buffer) != 0) {
                 asprintf(err_msg, "Failed to delete file: %s", buffer);
+                deferred_dirs_free(&later);
                 libssh2_sftp_closedir(dir);
                 return -1;
             }
@@ -427,7 +1208,16 @@ int sftp_remove_path_recursive(LIBSSH2_SFTP *sftp_session, const char *path, cha
 
     libssh2_sftp_closedir(dir);
 
-    // Finally remove the now-empty directory
+    for (size_t i = 0; i < later.count; i++) {
+        // Our handle is closed, so the child only adds to what ancestors hold
+        if (remove_path_at_depth(sftp_session, later.names[i], depth, max_handles, err_msg) != 0) {
+            deferred_dirs_free(&later);
+            return -1;
+        }
+    }
+    deferred_dirs_free(&later);
+
+    // Finally remove the now-empty directory
     if (libssh2_sftp_rmdir(sftp_session, path) != 0) {
         asprintf(err_msg, "Failed to remove directory: %s", path);
         return -1;
@@ -435,3 +1225,912 @@ int sftp_remove_path_recursive(LIBSSH2_SFTP *sftp_session, const char *path, cha
 
     return 0;
 }
+
+int sftp_remove_path_recursive(LIBSSH2_SFTP *sftp_session, const char *path, unsigned max_handles, char **err_msg) {
+    return remove_path_at_depth(sftp_session, path, 0, max_handles, err_msg);
+}
+
+// ---- Remote-to-remote copy -----------------------------------------------
+//
+// A reader thread streams the source file into a small ring of chunks while
+// the calling thread writes them to the destination, so both sessions keep
+// their pipelined requests in flight and nothing touches the local disk.
+
+#define COPY_STREAM_CHUNKS 8
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    LIBSSH2_SFTP_HANDLE *source;
+    char *chunks[COPY_STREAM_CHUNKS];
+    size_t lengths[COPY_STREAM_CHUNKS];
+    size_t chunk_bytes;
+    int head;
+    int count;
+    bool eof;
+    bool failed;     // the source read failed
+    bool cancelled;  // the writer gave up
+} copy_stream;
+
+static void *copy_reader_main(void *arg) {
+    copy_stream *stream = arg;
+
+    pthread_mutex_lock(&stream->lock);
+    while (!stream->cancelled) {
+        while (stream->count == COPY_STREAM_CHUNKS && !stream->cancelled) {
+            pthread_cond_wait(&stream->changed, &stream->lock);
+        }
+        if (stream->cancelled) {
+            break;
+        }
+        int slot = (stream->head + stream->count) % COPY_STREAM_CHUNKS;
+        pthread_mutex_unlock(&stream->lock);
+
+        // Fill the whole chunk; large reads let libssh2 keep several
+        // requests outstanding
+        size_t filled = 0;
+        ssize_t rc = 1;
+        while (filled < stream->chunk_bytes &&
+               (rc = libssh2_sftp_read(stream->source, stream->chunks[slot] + filled, stream->chunk_bytes - filled)) > 0) {
+            filled += (size_t)rc;
+        }
+
+        pthread_mutex_lock(&stream->lock);
+        if (filled > 0) {
+            stream->lengths[slot] = filled;
+            stream->count++;
+        }
+        if (rc <= 0) {
+            stream->eof = rc == 0;
+            stream->failed = rc < 0;
+            pthread_cond_broadcast(&stream->changed);
+            break;
+        }
+        pthread_cond_broadcast(&stream->changed);
+    }
+    pthread_mutex_unlock(&stream->lock);
+    return NULL;
+}
+
+// Create dst and its parents on the destination server. Bypasses the
+// directory cache, which only describes the primary server.
+static int ensure_copy_directory(LIBSSH2_SFTP *to, const char *path) {
+    char dir_path[1024];
+    char current_path[1024];
+    char *save_ptr = NULL;
+
+    snprintf(dir_path, sizeof(dir_path), "%s", path);
+    snprintf(current_path, sizeof(current_path), "%s", path[0] == '/' ? "/" : "");
+    for (char *part = strtok_r(dir_path, "/", &save_ptr); part; part = strtok_r(NULL, "/", &save_ptr)) {
+        size_t len = strlen(current_path);
+        snprintf(current_path + len, sizeof(current_path) - len, "%s%s",
+                 len > 0 && current_path[len - 1] != '/' ? "/" : "", part);
+
+        int kind = remote_stat_kind(to, current_path);
+        if (kind == 0) {
+            return 1;
+        }
+        if (kind < 0 && libssh2_sftp_mkdir(to, current_path, LIBSSH2_SFTP_S_IRWXU) != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int copy_remote_file(LIBSSH2_SFTP *from, LIBSSH2_SFTP *to, const char *src, const char *dst,
+                            const LIBSSH2_SFTP_ATTRIBUTES *attrs, size_t chunk_bytes,
+                            unsigned long long *copied, char **err_msg) {
+    char path_copy[1024];
+    snprintf(path_copy, sizeof(path_copy), "%s", dst);
+    if (ensure_copy_directory(to, dirname(path_copy)) != 0) {
+        asprintf(err_msg, "Failed to create destination directory for: %s", dst);
+        return 1;
+    }
+
+    LIBSSH2_SFTP_HANDLE *source = libssh2_sftp_open(from, src, LIBSSH2_FXF_READ, 0);
+    if (!source) {
+        asprintf(err_msg, "Unable to open source file '%s' (libssh2 error %lu)", src, libssh2_sftp_last_error(from));
+        return 1;
+    }
+
+    long mode = (attrs->flags & LIBSSH2_SFTP_ATTR_PERMISSIONS)
+        ? (long)(attrs->permissions & 0777) : (LIBSSH2_SFTP_S_IRUSR | LIBSSH2_SFTP_S_IWUSR);
+    LIBSSH2_SFTP_HANDLE *dest = libssh2_sftp_open(to, dst, LIBSSH2_FXF_WRITE | LIBSSH2_FXF_CREAT | LIBSSH2_FXF_TRUNC, mode);
+    if (!dest) {
+        asprintf(err_msg, "Unable to open destination file '%s' (libssh2 error %lu)", dst, libssh2_sftp_last_error(to));
+        libssh2_sftp_close(source);
+        return 1;
+    }
+
+    copy_stream stream = { .source = source, .chunk_bytes = chunk_bytes };
+    pthread_mutex_init(&stream.lock, NULL);
+    pthread_cond_init(&stream.changed, NULL);
+    int rc = 0;
+    for (int i = 0; i < COPY_STREAM_CHUNKS; i++) {
+        stream.chunks[i] = malloc(stream.chunk_bytes);
+        if (!stream.chunks[i]) {
+            rc = 1;
+        }
+    }
+
+    pthread_t reader;
+    if (rc != 0 || pthread_create(&reader, NULL, copy_reader_main, &stream) != 0) {
+        asprintf(err_msg, "Out of memory while copying: %s", src);
+        for (int i = 0; i < COPY_STREAM_CHUNKS; i++) {
+            free(stream.chunks[i]);
+        }
+        pthread_cond_destroy(&stream.changed);
+        pthread_mutex_destroy(&stream.lock);
+        libssh2_sftp_close(dest);
+        libssh2_sftp_close(source);
+        return 1;
+    }
+
+    unsigned long long total = (attrs->flags & LIBSSH2_SFTP_ATTR_SIZE) ? attrs->filesize : 0;
+    unsigned long long written = 0;
+    int last_percent = -1;
+
+    pthread_mutex_lock(&stream.lock);
+    while (1) {
+        while (stream.count == 0 && !stream.eof && !stream.failed) {
+            pthread_cond_wait(&stream.changed, &stream.lock);
+        }
+        if (stream.count == 0) {
+            if (stream.failed) {
+                asprintf(err_msg, "SFTP read error while copying from: %s", src);
+                rc = 1;
+            }
+            break;
+        }
+        char *ptr = stream.chunks[stream.head];
+        size_t remaining = stream.lengths[stream.head];
+        pthread_mutex_unlock(&stream.lock);
+
+        while (remaining > 0) {
+            ssize_t nwritten = libssh2_sftp_write(dest, ptr, remaining);
+            if (nwritten < 0) {
+                asprintf(err_msg, "SFTP write error while copying to: %s", dst);
+                rc = 1;
+                break;
+            }
+            ptr += nwritten;
+            remaining -= (size_t)nwritten;
+            written += (unsigned long long)nwritten;
+
+            int percent = total > 0 ? (int)(written * 100 / total) : 100;
+            if (percent != last_percent) {
+                printf("PROGRESS|%s|%d\n", dst, percent > 100 ? 100 : percent);
+                fflush(stdout);
+                last_percent = percent;
+            }
+        }
+
+        pthread_mutex_lock(&stream.lock);
+        if (rc != 0) {
+            break;
+        }
+        stream.head = (stream.head + 1) % COPY_STREAM_CHUNKS;
+        stream.count--;
+        pthread_cond_broadcast(&stream.changed);
+    }
+    stream.cancelled = true;
+    pthread_cond_broadcast(&stream.changed);
+    pthread_mutex_unlock(&stream.lock);
+    pthread_join(reader, NULL);
+
+    for (int i = 0; i < COPY_STREAM_CHUNKS; i++) {
+        free(stream.chunks[i]);
+    }
+    pthread_cond_destroy(&stream.changed);
+    pthread_mutex_destroy(&stream.lock);
+    libssh2_sftp_close(dest);
+    libssh2_sftp_close(source);
+
+    *copied += written;
+    return rc;
+}
+
+// Copy a file or a whole tree from one server to another. Each directory is
+// listed completely and closed before descending, so at most one directory
+// and two file handles are open at a time. Symlinks inside a tree are skipped.
+// Writes are chunk_bytes, which must suit the destination server.
+static int copy_remote_path(LIBSSH2_SFTP *from, LIBSSH2_SFTP *to, const char *src, const char *dst,
+                            size_t chunk_bytes, unsigned long long *copied, char **err_msg) {
+    LIBSSH2_SFTP_ATTRIBUTES attrs;
+    if (libssh2_sftp_stat(from, src, &attrs) != 0) {
+        asprintf(err_msg, "Failed to stat source path: %s", src);
+        return 1;
+    }
+    if (!LIBSSH2_SFTP_S_ISDIR(attrs.permissions)) {
+        return copy_remote_file(from, to, src, dst, &attrs, chunk_bytes, copied, err_msg);
+    }
+
+    if (ensure_copy_directory(to, dst) != 0) {
+        asprintf(err_msg, "Failed to create destination directory: %s", dst);
+        return 1;
+    }
+
+    LIBSSH2_SFTP_HANDLE *dir = libssh2_sftp_opendir(from, src);
+    if (!dir) {
+        asprintf(err_msg, "Failed to open source directory: %s", src);
+        return 1;
+    }
+
+    deferred_dirs children = {0};
+    char entry[256];
+    int rc = 0;
+    while (rc == 0) {
+        LIBSSH2_SFTP_ATTRIBUTES entry_attrs;
+        int len = libssh2_sftp_readdir(dir, entry, sizeof(entry) - 1, &entry_attrs);
+        if (len <= 0) {
+            break;
+        }
+        entry[len] = '\0';
+        if (strcmp(entry, ".") == 0 || strcmp(entry, "..") == 0) {
+            continue;
+        }
+        if (LIBSSH2_SFTP_S_ISLNK(entry_attrs.permissions)) {
+            fprintf(stderr, "DEBUG: Not copying symlink %s/%s\n", src, entry);
+            continue;
+        }
+        if (deferred_dirs_add(&children, entry) != 0) {
+            asprintf(err_msg, "Out of memory while copying: %s", src);
+            rc = 1;
+        }
+    }
+    libssh2_sftp_closedir(dir);
+
+    for (size_t i = 0; rc == 0 && i < children.count; i++) {
+        char child_src[1024];
+        char child_dst[1024];
+        snprintf(child_src, sizeof(child_src), "%s/%s", src, children.names[i]);
+        snprintf(child_dst, sizeof(child_dst), "%s/%s", dst, children.names[i]);
+        rc = copy_remote_path(from, to, child_src, child_dst, chunk_bytes, copied, err_msg);
+    }
+    deferred_dirs_free(&children);
+    return rc;
+}
+
+int sftp_copy_path(LIBSSH2_SFTP *from, LIBSSH2_SFTP *to, const char *src, const char *dst,
+                   size_t chunk_bytes, unsigned long long *copied, char **err_msg) {
+    *copied = 0;
+    return copy_remote_path(from, to, src, dst, chunk_bytes, copied, err_msg);
+}
+
+// ---- Releases ------------------------------------------------------------
+//
+// A release is staged next to the live symlink, in <parent>/releases/<name>,
+// and starts out as a hardlink farm of the release live points at, so only
+// changed files have to be uploaded. Publishing swaps the symlink with a
+// single rename, so readers see either the old tree or the new one.
+
+// Single quote arg for a POSIX shell. Returns -1 if it doesn't fit.
+static int shell_quote(const char *arg, char *out, size_t size) {
+    size_t used = 0;
+    if (size < 3) {
+        return -1;
+    }
+    out[used++] = '\'';
+    for (const char *p = arg; *p; p++) {
+        const char *piece = *p == '\'' ? "'\\''" : NULL;
+        size_t len = piece ? 4 : 1;
+        if (used + len + 2 > size) {
+            return -1;
+        }
+        if (piece) {
+            memcpy(out + used, piece, len);
+        } else {
+            out[used] = *p;
+        }
+        used += len;
+    }
+    out[used++] = '\'';
+    out[used] = '\0';
+    return 0;
+}
+
+// Seed dir from the release live points at: one "cp -al" where exec is
+// allowed, otherwise a full copy over a second session. Without a current
+// release the staging directory simply starts out empty.
+int release_stage(transmit_connection *conn, const server_capabilities *caps, const char *live, const char *dir, char **err_msg) {
+    LIBSSH2_SFTP *sftp = conn->sftp_session;
+    LIBSSH2_SFTP_ATTRIBUTES attrs;
+    char previous[1024] = "";
+
+    int rc = libssh2_sftp_lstat(sftp, live, &attrs);
+    if (rc == 0) {
+        if (!LIBSSH2_SFTP_S_ISLNK(attrs.permissions)) {
+            asprintf(err_msg, "'%s' is not a symlink; move it into releases/ and link it there once", live);
+            return 1;
+        }
+        if (libssh2_sftp_realpath(sftp, live, previous, sizeof(previous)) <= 0) {
+            asprintf(err_msg, "Can't resolve the release '%s' points to", live);
+            return 1;
+        }
+    } else if (rc != LIBSSH2_ERROR_SFTP_PROTOCOL || libssh2_sftp_last_error(sftp) != LIBSSH2_FX_NO_SUCH_FILE) {
+        asprintf(err_msg, "Failed to stat '%s'", live);
+        return 1;
+    }
+
+    char parent[1024];
+    snprintf(parent, sizeof(parent), "%s", dir);
+    if (create_remote_directory_recursively(sftp, previous[0] ? dirname(parent) : dir) != 0) {
+        asprintf(err_msg, "Failed to create remote directory: %s", previous[0] ? parent : dir);
+        return 1;
+    }
+    if (!previous[0]) {
+        return 0;
+    }
+
+    if (caps->exec) {
+        char from[1100], to[1100], quoted_from[2300], quoted_to[2300], command[7000];
+        snprintf(from, sizeof(from), "%s/.", previous);
+        snprintf(to, sizeof(to), "%s/", dir);
+        if (shell_quote(from, quoted_from, sizeof(quoted_from)) == 0 &&
+            shell_quote(to, quoted_to, sizeof(quoted_to)) == 0) {
+            snprintf(command, sizeof(command), "mkdir -p %s && cp -al %s %s", quoted_to, quoted_from, quoted_to);
+            int status = exec_remote_command(conn->session, command, NULL, 0);
+            if (status == 0) {
+                return 0;
+            }
+            fprintf(stderr, "DEBUG: cp -al into %s failed (%d), copying instead\n", dir, status);
+
+            // Unlinking only drops the links, never the live files
+            char *ignored = NULL;
+            sftp_remove_path_recursive(sftp, dir, transfer_open_handles(conn), &ignored);
+            free(ignored);
+            dir_cache_forget(dir);
+        }
+    }
+
+    transmit_connection source = { .sock = -1 };
+    connection_template(conn, &source);
+    if (connect_session(&source) != 0) {
+        asprintf(err_msg, "Failed to open a second session to seed '%s'", dir);
+        return 1;
+    }
+    unsigned long long copied = 0;
+    rc = sftp_copy_path(source.sftp_session, sftp, previous, dir, transfer_write_bytes(conn), &copied, err_msg);
+    drop_session(&source);
+    return rc;
+}
+
+// Point live at dir. The new link is made beside live and renamed over it;
+// posix-rename does that over SFTP, "mv -T" over exec otherwise.
+int release_publish(transmit_connection *conn, const server_capabilities *caps, const char *live, const char *dir, char **err_msg) {
+    LIBSSH2_SFTP *sftp = conn->sftp_session;
+    const char *name = strrchr(dir, '/');
+    char target[1024], next[1100];
+    // Relative, so the tree still works when moved or mounted elsewhere
+    snprintf(target, sizeof(target), "releases/%s", name ? name + 1 : dir);
+    snprintf(next, sizeof(next), "%s.transmit-next", live);
+
+    if (caps->posix_rename) {
+        libssh2_sftp_unlink(sftp, next);
+        // OpenSSH reads the link target first, which is the order libssh2 sends
+        if (libssh2_sftp_symlink(sftp, target, next) == 0 &&
+            libssh2_sftp_posix_rename(sftp, next, live) == 0) {
+            return 0;
+        }
+        libssh2_sftp_unlink(sftp, next);
+    }
+
+    if (caps->exec) {
+        char quoted_target[2100], quoted_next[2300], quoted_live[2100], command[8900];
+        if (shell_quote(target, quoted_target, sizeof(quoted_target)) != 0 ||
+            shell_quote(next, quoted_next, sizeof(quoted_next)) != 0 ||
+            shell_quote(live, quoted_live, sizeof(quoted_live)) != 0) {
+            asprintf(err_msg, "Release path too long: %s", live);
+            return 1;
+        }
+        snprintf(command, sizeof(command), "ln -sfn %s %s && mv -Tf %s %s",
+                 quoted_target, quoted_next, quoted_next, quoted_live);
+        int status = exec_remote_command(conn->session, command, NULL, 0);
+        if (status == 0) {
+            return 0;
+        }
+        asprintf(err_msg, "Swapping '%s' to %s failed (exit status %d)", live, target, status);
+        return 1;
+    }
+
+    asprintf(err_msg, "Switching '%s' needs posix-rename or exec, and the server offers neither", live);
+    return 1;
+}
+
+// ---- Remote hooks --------------------------------------------------------
+
+// Run a frontend's hook command under sh, with stderr folded into output,
+// which comes back flattened to one line. Returns the exit status, or -1 if
+// the command couldn't be started.
+int run_remote_hook(LIBSSH2_SESSION *session, const char *command, char *output, size_t output_size) {
+    char quoted[2300], wrapped[2400];
+    output[0] = '\0';
+    if (shell_quote(command, quoted, sizeof(quoted)) != 0) {
+        snprintf(output, output_size, "hook command too long");
+        return -1;
+    }
+    snprintf(wrapped, sizeof(wrapped), "sh -c %s 2>&1", quoted);
+
+    int status = exec_remote_command(session, wrapped, output, output_size);
+    size_t len = strlen(output);
+    for (size_t i = 0; i < len; i++) {
+        if (output[i] == '\n' || output[i] == '\r' || output[i] == '\t') {
+            output[i] = ' ';
+        }
+    }
+    while (len > 0 && output[len - 1] == ' ') {
+        output[--len] = '\0';
+    }
+    return status;
+}
+
+// ---- Operation journal ---------------------------------------------------
+//
+// Lines are tab separated: "A <seq> <op> <local> <remote>" when a command is
+// accepted and "D <seq>" once its result was reported. Appends go straight to
+// the file, so they survive the helper or editor being killed; fsync is
+// batched by the caller. Compaction rewrites only the live entries through a
+// temporary file and a rename, which also drops a torn final line.
+
+static int journal_write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int journal_format_accept(const journal_entry *entry, char *line, size_t size) {
+    return snprintf(line, size, "A\t%lu\t%s\t%s\t%s\n", entry->seq, entry->op, entry->local, entry->remote);
+}
+
+static int journal_track(transmit_journal *journal, const journal_entry *entry) {
+    if (journal->live_count == journal->live_capacity) {
+        size_t capacity = journal->live_capacity ? journal->live_capacity * 2 : 32;
+        journal_entry *live = realloc(journal->live, capacity * sizeof(*live));
+        if (!live) {
+            return -1;
+        }
+        journal->live = live;
+        journal->live_capacity = capacity;
+    }
+    journal->live[journal->live_count++] = *entry;
+    return 0;
+}
+
+static void journal_untrack(transmit_journal *journal, unsigned long seq) {
+    for (size_t i = 0; i < journal->live_count; i++) {
+        if (journal->live[i].seq == seq) {
+            memmove(&journal->live[i], &journal->live[i + 1], (journal->live_count - i - 1) * sizeof(*journal->live));
+            journal->live_count--;
+            return;
+        }
+    }
+}
+
+// Split one tab separated field off *cursor, or NULL if none is left
+static char *journal_field(char **cursor) {
+    char *field = *cursor;
+    if (!field) {
+        return NULL;
+    }
+    char *tab = strchr(field, '\t');
+    if (tab) {
+        *tab = '\0';
+        *cursor = tab + 1;
+    } else {
+        *cursor = NULL;
+    }
+    return field;
+}
+
+static void journal_parse_line(transmit_journal *journal, char *line) {
+    char *cursor = line;
+    char *kind = journal_field(&cursor);
+    char *seq_text = journal_field(&cursor);
+    if (!kind || !seq_text) {
+        return;
+    }
+    unsigned long seq = strtoul(seq_text, NULL, 10);
+    if (seq >= journal->next_seq) {
+        journal->next_seq = seq + 1;
+    }
+
+    if (strcmp(kind, "D") == 0) {
+        journal_untrack(journal, seq);
+        return;
+    }
+
+    char *op = journal_field(&cursor);
+    char *local = journal_field(&cursor);
+    char *remote = journal_field(&cursor);
+    if (strcmp(kind, "A") != 0 || !op || !local || !remote) {
+        return;
+    }
+
+    journal_entry entry = { .seq = seq };
+    snprintf(entry.op, sizeof(entry.op), "%s", op);
+    snprintf(entry.local, sizeof(entry.local), "%s", local);
+    snprintf(entry.remote, sizeof(entry.remote), "%s", remote);
+    journal_track(journal, &entry);
+}
+
+static int journal_load(transmit_journal *journal) {
+    struct stat st;
+    if (fstat(journal->fd, &st) != 0) {
+        return -1;
+    }
+
+    char *data = malloc((size_t)st.st_size + 1);
+    if (!data) {
+        return -1;
+    }
+    size_t len = 0;
+    while (len < (size_t)st.st_size) {
+        ssize_t n = pread(journal->fd, data + len, (size_t)st.st_size - len, (off_t)len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        len += n;
+    }
+
+    // Only newline-terminated lines count; a torn tail is a write that
+    // never finished
+    char *line = data;
+    char *newline;
+    while ((newline = memchr(line, '\n', len - (size_t)(line - data))) != NULL) {
+        *newline = '\0';
+        journal_parse_line(journal, line);
+        line = newline + 1;
+    }
+
+    free(data);
+    return 0;
+}
+
+static int journal_compact(transmit_journal *journal) {
+    char tmp_path[sizeof(journal->path) + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", journal->path);
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return -1;
+    }
+
+    size_t bytes = 0;
+    char line[600];
+    for (size_t i = 0; i < journal->live_count; i++) {
+        int len = journal_format_accept(&journal->live[i], line, sizeof(line));
+        if (len < 0 || journal_write_all(fd, line, (size_t)len) != 0) {
+            close(fd);
+            unlink(tmp_path);
+            return -1;
+        }
+        bytes += len;
+    }
+
+    if (fsync(fd) != 0 || rename(tmp_path, journal->path) != 0) {
+        close(fd);
+        unlink(tmp_path);
+        return -1;
+    }
+    close(fd);
+
+    int new_fd = open(journal->path, O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (new_fd < 0) {
+        return -1;
+    }
+    if (journal->fd >= 0) {
+        close(journal->fd);
+    }
+    journal->fd = new_fd;
+    journal->bytes = bytes;
+    journal->dirty = false;
+    return 0;
+}
+
+// Open (or create) the journal at path and load the operations left
+// unfinished by a previous helper. Returns -1 and leaves journaling off if
+// the file can't be used or another helper already owns it.
+int journal_open(transmit_journal *journal, const char *path) {
+    memset(journal, 0, sizeof(*journal));
+    journal->fd = -1;
+    journal->lock_fd = -1;
+    journal->next_seq = 1;
+    snprintf(journal->path, sizeof(journal->path), "%s", path);
+
+    // The lock lives in its own file because compaction replaces the journal
+    char lock_path[sizeof(journal->path) + 8];
+    snprintf(lock_path, sizeof(lock_path), "%s.lock", path);
+    journal->lock_fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (journal->lock_fd < 0) {
+        return -1;
+    }
+    if (flock(journal->lock_fd, LOCK_EX | LOCK_NB) != 0) {
+        fprintf(stderr, "DEBUG: Journal %s is in use by another helper\n", path);
+        close(journal->lock_fd);
+        journal->lock_fd = -1;
+        return -1;
+    }
+
+    journal->fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (journal->fd < 0 || journal_load(journal) != 0 || journal_compact(journal) != 0) {
+        journal_close(journal);
+        return -1;
+    }
+    return 0;
+}
+
+// Record an accepted operation. Returns its sequence number, or 0 when
+// journaling is off.
+unsigned long journal_accept(transmit_journal *journal, const char *op, const char *local, const char *remote) {
+    if (journal->fd < 0) {
+        return 0;
+    }
+
+    journal_entry entry = { .seq = journal->next_seq++ };
+    snprintf(entry.op, sizeof(entry.op), "%s", op);
+    snprintf(entry.local, sizeof(entry.local), "%s", local);
+    snprintf(entry.remote, sizeof(entry.remote), "%s", remote);
+
+    char line[600];
+    int len = journal_format_accept(&entry, line, sizeof(line));
+    if (len < 0 || journal_track(journal, &entry) != 0 ||
+        journal_write_all(journal->fd, line, (size_t)len) != 0) {
+        return 0;
+    }
+    journal->bytes += len;
+    journal->dirty = true;
+    return entry.seq;
+}
+
+// Record that the result for seq was reported
+void journal_complete(transmit_journal *journal, unsigned long seq) {
+    if (journal->fd < 0 || seq == 0) {
+        return;
+    }
+
+    journal_untrack(journal, seq);
+
+    char line[32];
+    int len = snprintf(line, sizeof(line), "D\t%lu\n", seq);
+    if (journal_write_all(journal->fd, line, (size_t)len) == 0) {
+        journal->bytes += len;
+        journal->dirty = true;
+    }
+
+    if (journal->bytes > JOURNAL_COMPACT_BYTES) {
+        journal_compact(journal);
+    }
+}
+
+// Make everything appended so far durable; callers batch this between bursts
+void journal_sync(transmit_journal *journal) {
+    if (journal->fd < 0 || !journal->dirty) {
+        return;
+    }
+    fsync(journal->fd);
+    journal->dirty = false;
+}
+
+void journal_close(transmit_journal *journal) {
+    journal_sync(journal);
+    if (journal->fd >= 0) {
+        close(journal->fd);
+        journal->fd = -1;
+    }
+    if (journal->lock_fd >= 0) {
+        close(journal->lock_fd);
+        journal->lock_fd = -1;
+    }
+    free(journal->live);
+    journal->live = NULL;
+    journal->live_count = journal->live_capacity = 0;
+}
+
+// ---- Server capabilities -------------------------------------------------
+
+// Run command over an exec channel, keeping up to output_size - 1 bytes of
+// its stdout. Returns the exit status, or -1 if exec isn't possible.
+int exec_remote_command(LIBSSH2_SESSION *session, const char *command, char *output, size_t output_size) {
+    LIBSSH2_CHANNEL *channel = libssh2_channel_open_session(session);
+    if (!channel) {
+        return -1;
+    }
+    // Nothing reads stderr; unread, it would fill the channel window and
+    // stall a chatty command such as cp -al
+    libssh2_channel_handle_extended_data2(channel, LIBSSH2_CHANNEL_EXTENDED_DATA_IGNORE);
+    if (libssh2_channel_exec(channel, command) != 0) {
+        libssh2_channel_free(channel);
+        return -1;
+    }
+
+    size_t used = 0;
+    char discard[1024];
+    while (1) {
+        char *dest = discard;
+        size_t room = sizeof(discard);
+        if (output && used + 1 < output_size) {
+            dest = output + used;
+            room = output_size - 1 - used;
+        }
+        ssize_t n = libssh2_channel_read(channel, dest, room);
+        if (n <= 0) {
+            break;
+        }
+        if (dest != discard) {
+            used += n;
+        }
+    }
+    if (output && output_size > 0) {
+        output[used] = '\0';
+    }
+
+    libssh2_channel_close(channel);
+    libssh2_channel_wait_closed(channel);
+    int status = libssh2_channel_get_exit_status(channel);
+    libssh2_channel_free(channel);
+    return status;
+}
+
+static void hostkey_digest(LIBSSH2_SESSION *session, char *hex, size_t hex_size) {
+    const unsigned char *hash = (const unsigned char *)libssh2_hostkey_hash(session, LIBSSH2_HOSTKEY_HASH_SHA256);
+    hex[0] = '\0';
+    if (!hash || hex_size < 65) {
+        return;
+    }
+    for (int i = 0; i < 32; i++) {
+        snprintf(hex + i * 2, 3, "%02x", hash[i]);
+    }
+}
+
+// Assumptions used until a probe says otherwise
+void capabilities_defaults(server_capabilities *caps) {
+    memset(caps, 0, sizeof(*caps));
+    caps->scp = true;
+}
+
+int capabilities_load(server_capabilities *caps, const char *path) {
+    capabilities_defaults(caps);
+
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return -1;
+    }
+
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        char *eq = strchr(line, '=');
+        if (!eq) {
+            continue;
+        }
+        *eq = '\0';
+        char *value = eq + 1;
+        value[strcspn(value, "\r\n")] = '\0';
+        bool flag = strcmp(value, "1") == 0;
+
+        if (strcmp(line, "hostkey") == 0) {
+            snprintf(caps->hostkey_sha256, sizeof(caps->hostkey_sha256), "%s", value);
+        } else if (strcmp(line, "probed_at") == 0) {
+            caps->probed_at = (time_t)strtoll(value, NULL, 10);
+        } else if (strcmp(line, "posix_rename") == 0) {
+            caps->posix_rename = flag;
+        } else if (strcmp(line, "exec") == 0) {
+            caps->exec = flag;
+        } else if (strcmp(line, "scp") == 0) {
+            caps->scp = flag;
+        } else if (strcmp(line, "max_write") == 0) {
+            caps->max_write = strtoul(value, NULL, 10);
+        } else if (strcmp(line, "max_open_handles") == 0) {
+            caps->max_open_handles = (unsigned)strtoul(value, NULL, 10);
+        } else if (strcmp(line, "max_connections") == 0) {
+            caps->max_connections = (unsigned)strtoul(value, NULL, 10);
+        }
+    }
+    fclose(file);
+    return 0;
+}
+
+// Written through a temporary file so a crash never leaves half a record
+int capabilities_save(const server_capabilities *caps, const char *path) {
+    char tmp_path[1024];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    FILE *file = fopen(tmp_path, "w");
+    if (!file) {
+        return -1;
+    }
+    fprintf(file, "hostkey=%s\n", caps->hostkey_sha256);
+    fprintf(file, "probed_at=%lld\n", (long long)caps->probed_at);
+    fprintf(file, "posix_rename=%d\n", caps->posix_rename);
+    fprintf(file, "exec=%d\n", caps->exec);
+    fprintf(file, "scp=%d\n", caps->scp);
+    fprintf(file, "max_write=%lu\n", caps->max_write);
+    fprintf(file, "max_open_handles=%u\n", caps->max_open_handles);
+    fprintf(file, "max_connections=%u\n", caps->max_connections);
+
+    if (fclose(file) != 0 || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+// A record is reused while the host key matches and it isn't too old;
+// checking costs no round trip since the key came with the handshake
+bool capabilities_current(const server_capabilities *caps, LIBSSH2_SESSION *session) {
+    char digest[65];
+    hostkey_digest(session, digest, sizeof(digest));
+    return digest[0] && strcmp(digest, caps->hostkey_sha256) == 0 &&
+           caps->max_write > 0 && time(NULL) - caps->probed_at < CAPABILITIES_MAX_AGE;
+}
+
+// Probe what the server offers: one SFTP request and one exec channel
+void capabilities_probe(server_capabilities *caps, LIBSSH2_SESSION *session, LIBSSH2_SFTP *sftp_session) {
+    bool scp = caps->scp;
+    capabilities_defaults(caps);
+    caps->scp = scp;
+    hostkey_digest(session, caps->hostkey_sha256, sizeof(caps->hostkey_sha256));
+    caps->probed_at = time(NULL);
+
+    // Renaming a path that can't exist fails either way; only the status
+    // tells whether the extension itself is known
+    static const char probe_path[] = "/.transmit-capability-probe";
+    int rc = libssh2_sftp_posix_rename_ex(sftp_session, probe_path, sizeof(probe_path) - 1,
+                                          probe_path, sizeof(probe_path) - 1);
+    caps->posix_rename = rc == 0 ||
+        (rc == LIBSSH2_ERROR_SFTP_PROTOCOL && libssh2_sftp_last_error(sftp_session) != LIBSSH2_FX_OP_UNSUPPORTED);
+
+    // libssh2 can't send limits@openssh.com, so take the limits OpenSSH
+    // advertises there from its version, and safe defaults from anyone else
+    int major = 0, minor = 0;
+    const char *banner = libssh2_session_banner_get(session);
+    const char *openssh = banner ? strstr(banner, "OpenSSH_") : NULL;
+    if (openssh && sscanf(openssh, "OpenSSH_%d.%d", &major, &minor) == 2 &&
+        (major > 8 || (major == 8 && minor >= 6))) {
+        caps->max_write = OPENSSH_MAX_WRITE;
+        caps->max_open_handles = OPENSSH_MAX_OPEN_HANDLES;
+    } else {
+        caps->max_write = SAFE_MAX_WRITE;
+        caps->max_open_handles = SAFE_MAX_OPEN_HANDLES;
+    }
+
+    // Releases seed and publish through exec channels
+    caps->exec = exec_remote_command(session, "true", NULL, 0) == 0;
+}
+
+// Size writes and handle use on conn, and the connections templated from
+// it, from the server's probed limits
+void apply_transfer_limits(transmit_connection *conn, const server_capabilities *caps) {
+    conn->max_write = caps->max_write;
+    conn->max_open_handles = caps->max_open_handles;
+}
+
+// Bytes handed to each libssh2_sftp_write. libssh2 splits a call into
+// packets of its own maximum and keeps them all in flight, so a larger chunk
+// means fewer waits for acknowledgements per MB. Servers that were never
+// probed, such as copy endpoints, get what every server must accept.
+size_t transfer_write_bytes(const transmit_connection *conn) {
+    return conn->max_write > 0 ? conn->max_write : SAFE_MAX_WRITE;
+}
+
+// Handles a single operation may hold open at once
+unsigned transfer_open_handles(const transmit_connection *conn) {
+    return conn->max_open_handles > 0 ? conn->max_open_handles : SAFE_MAX_OPEN_HANDLES;
+}
+
+// Most payload a single blocking write call on conn moves, for sizing its timeout
+size_t transfer_call_bytes(const transmit_connection *conn) {
+    size_t write_bytes = transfer_write_bytes(conn);
+    return write_bytes > SCP_CHUNK_BYTES ? write_bytes : SCP_CHUNK_BYTES;
+}
@@ -2,15 +2,118 @@
 #ifndef TRANSMIT_H
 #define TRANSMIT_H
 
+// Bumped when the helper learns commands or output lines that frontends
+// must not rely on from older binaries
+#define TRANSMIT_PROTOCOL_VERSION 10
+
+// connect_session result when the server accepted the TCP connection but
+// turned the SSH session down, as it does past MaxStartups
+#define SESSION_REFUSED (-2)
+
+// Everything needed to (re)establish a session without asking the frontend
+// for credentials again
+typedef struct {
+    char hostname[256];
+    char username[128];
+    char auth_method[16];
+    char privkey_path[256];
+    char password[256];
+    LIBSSH2_SFTP *sftp_session;
+    LIBSSH2_SESSION *session;
+    int sock;
+    int keepalive_interval;
+    unsigned long max_write;    // bytes per SFTP write this server takes, 0 = unknown
+    unsigned max_open_handles;  // handles one operation may hold open, 0 = unknown
+} transmit_connection;
+
+// Warm spare session kept authenticated in the background for failover
+typedef struct {
+    transmit_connection template;
+    transmit_connection conn;
+    transmit_connection retired;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int running;
+    int ready;
+    int stop;
+} transmit_standby;
+
+// An operation the helper accepted but has not reported a result for
+typedef struct {
+    unsigned long seq;
+    char op[16];
+    char local[256];
+    char remote[256];
+} journal_entry;
+
+// Append-only record of accepted and completed operations, so a helper that
+// dies mid-sync can finish the unfinished tail on its next start
+typedef struct {
+    int fd;                  // -1 while journaling is off
+    int lock_fd;
+    char path[512];
+    unsigned long next_seq;
+    journal_entry *live;     // accepted, not yet completed, oldest first
+    size_t live_count;
+    size_t live_capacity;
+    size_t bytes;            // current size of the journal file
+    bool dirty;              // appended to since the last fsync
+} transmit_journal;
+
+// What a server supports, probed once and persisted per account. A record
+// is only trusted while the server presents the same host key.
+typedef struct {
+    char hostkey_sha256[65];  // hex digest of the host key the probe ran against
+    time_t probed_at;
+    bool posix_rename;        // posix-rename@openssh.com
+    bool exec;                // exec channels are allowed
+    bool scp;                 // cleared once the server refuses an SCP channel
+    unsigned long max_write;  // bytes handed to each SFTP write, 0 = unknown
+    unsigned max_open_handles; // handles we may hold open at once, 0 = unknown
+    unsigned max_connections; // parallel connections before the server refused one, 0 = unknown
+} server_capabilities;
+
 bool is_directory(const char *path);
 int create_remote_directory_recursively(LIBSSH2_SFTP *sftp_session, const char *path);
 int create_directory(LIBSSH2_SFTP *sftp_session, const char *directory);
+int prewarm_remote_directory(LIBSSH2_SFTP *sftp_session, LIBSSH2_SESSION *session, const char *path);
+void dir_cache_forget(const char *path);
 int init_sftp_session(const char *hostname, const char *username, const char *privkey_path, LIBSSH2_SFTP **sftp_session, LIBSSH2_SESSION **session, int *sock);
 void close_sftp_session(LIBSSH2_SFTP *sftp_session, LIBSSH2_SESSION *session, int sock);
-int upload_file(LIBSSH2_SFTP *sftp_session, const char *local_file, const char *remote_file, char **err_msg);
-int sftp_remove_path_recursive(LIBSSH2_SFTP *sftp_session, const char *path, char **err_msg);
+int upload_file(LIBSSH2_SFTP *sftp_session, const char *local_file, const char *remote_file, size_t chunk_bytes, char **err_msg);
+int scp_upload_file(LIBSSH2_SESSION *session, LIBSSH2_SFTP *sftp_session, const char *local_file, const char *remote_file, char **err_msg);
+int sftp_remove_path_recursive(LIBSSH2_SFTP *sftp_session, const char *path, unsigned max_handles, char **err_msg);
+int sftp_copy_path(LIBSSH2_SFTP *from, LIBSSH2_SFTP *to, const char *src, const char *dst, size_t chunk_bytes, unsigned long long *copied, char **err_msg);
+int release_stage(transmit_connection *conn, const server_capabilities *caps, const char *live, const char *dir, char **err_msg);
+int release_publish(transmit_connection *conn, const server_capabilities *caps, const char *live, const char *dir, char **err_msg);
+int run_remote_hook(LIBSSH2_SESSION *session, const char *command, char *output, size_t output_size);
 int is_sftp_session_alive(LIBSSH2_SFTP *sftp_session, LIBSSH2_SESSION *session);
 int is_socket_closed(int sock);
 int init_sftp_session_password(const char *hostname, const char *username, const char *password, LIBSSH2_SFTP **sftp_session, LIBSSH2_SESSION **session, int *sock);
+void connection_template(const transmit_connection *from, transmit_connection *to);
+int connect_session(transmit_connection *conn);
+void drop_session(transmit_connection *conn);
+int reconnect_session(transmit_connection *conn);
+int is_connection_error(LIBSSH2_SESSION *session);
+int standby_start(transmit_standby *standby, const transmit_connection *conn);
+int standby_take(transmit_standby *standby, transmit_connection *conn);
+void standby_stop(transmit_standby *standby);
+int recover_session(transmit_connection *conn, transmit_standby *standby);
+int exec_remote_command(LIBSSH2_SESSION *session, const char *command, char *output, size_t output_size);
+void capabilities_defaults(server_capabilities *caps);
+int capabilities_load(server_capabilities *caps, const char *path);
+int capabilities_save(const server_capabilities *caps, const char *path);
+bool capabilities_current(const server_capabilities *caps, LIBSSH2_SESSION *session);
+void capabilities_probe(server_capabilities *caps, LIBSSH2_SESSION *session, LIBSSH2_SFTP *sftp_session);
+void apply_transfer_limits(transmit_connection *conn, const server_capabilities *caps);
+size_t transfer_write_bytes(const transmit_connection *conn);
+unsigned transfer_open_handles(const transmit_connection *conn);
+size_t transfer_call_bytes(const transmit_connection *conn);
+int journal_open(transmit_journal *journal, const char *path);
+unsigned long journal_accept(transmit_journal *journal, const char *op, const char *local, const char *remote);
+void journal_complete(transmit_journal *journal, unsigned long seq);
+void journal_sync(transmit_journal *journal);
+void journal_close(transmit_journal *journal);
 
 #endif